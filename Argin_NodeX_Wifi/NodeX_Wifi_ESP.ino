@@ -9,6 +9,22 @@ Author: Kankan Sarkar
 Modifications : 17/01/2018-- V1.0-- Initial Creation, MQTT Test, UART TEST
                 18/01/2018-- V1.1-- Implemented Network Filter
                 21/03/2019-- V1.2-- Final version
+                19/10/2026-- V1.3-- Forward full frames, subscribe to coordinator schedule
+                19/10/2026-- V1.4-- MQTT last will towards the coordinator, short keepalive
+                19/10/2026-- V1.5-- Cache retained charger availability, forward changes only
+                19/10/2026-- V1.6-- Availability of every zone coordinator, shared last will topic
+                19/10/2026-- V1.7-- Token ring topic for token passing arbitration
+                19/10/2026-- V1.8-- Relay peer SOC from the dashboard topic, changes and refreshes only
+                19/10/2026-- V1.9-- SOC band broadcast topics, subscribed at or above own SOC
+                19/10/2026-- V1.10-- Objections answered by the bridge from the cached node SOC
+                19/10/2026-- V1.11-- Drain UART per pass, publish in place from the frame buffer, bridge counters
+                19/10/2026-- V1.12-- Non blocking reconnect with backoff, store and forward during outages
+                19/10/2026-- V1.13-- Ordered broker list, health echo and failover
+                19/10/2026-- V1.14-- Own frames dropped before parsing, short expiry of held charge requests
+                19/10/2026-- V1.15-- Acknowledged control frames with resend window, persistent session
+                19/10/2026-- V1.16-- Broker link state towards the node, replayed telemetry topic
+                19/10/2026-- V1.17-- Peer keepalive frames refresh the cached peer SOC
+                19/10/2026-- V1.18-- Needy peer SOC on banded peer topics instead of the dashboard topic
 
 ***/
 #include <ESP8266WiFi.h>  // Wifi Driver
@@ -16,32 +32,144 @@ Modifications : 17/01/2018-- V1.0-- Initial Creation, MQTT Test, UART TEST
 
 const char* ssid = "AIRTEL_GILL"; // Put Your SSID
 const char* password = "A!RTEL_G!LL"; // Put Your Password
-const char* mqtt_server = "192.168.0.101";  // Server Address
+const char* mqtt_servers[] = {"192.168.0.101", "192.168.0.102"};  // Broker addresses, in order of preference
+#define brokers (sizeof(mqtt_servers)/sizeof(mqtt_servers[0]))
 //#define debug 1
 #define node_id 3 // Define Node ID which the Wifi Module will be paired
 const char *myname="NODE3"; // define Client Name for MQTT Connection initiation
-#define coordinator_id 0x05 // Define coordinator ID
 #define disp_id 10			// Dashboard ID
+#define sched_id 11			// Coordinator reservation schedule topic
+#define op_lost 8			// last will opcode, coordinator releases the charger of a lost node
+#define avail_id 12			// retained charger availability topic, avail_id/<coordinator id>
+#define lost_id 13			// last will topic, heard by every zone coordinator
+#define token_id 15			// token ring topic, joins/leaves of nodes needing charge
+#define peer_id 21			// needy peer SOC topic, peer_id/<SOC/band_width>: id,soc,op,charging, published by nodes at or below nominal SOC
+#define peer_bands 4		// peer bands 0..3, nodes above nominal SOC (30) do not publish
+#define band_width 10		// SOC points per broadcast band topic, 255/<SOC/band_width>
+#define bands 11			// band topics covering SOC 0..100
+#define bridge_id 0			// frames for the bridge itself (node SOC push), never published
+#define op_request 0		// charge request/broadcast (legacy frame without opcode)
+#define op_object 18		// objection on the band topic: id,soc,op,objected node
+#define op_time 20			// time request of the node to the master coordinator: id,soc,op,t1
+#define objection_slot 30	// ms of objection delay per SOC point, the lowest SOC replies first
+#define objection_jitter 200	// ms of random objection delay, spreads equal SOC replies
+#define max_objections 4	// objections scheduled at once, one per broadcaster
+#define health_id 17			// broker health echo topic, health_id/node_id, published and heard back by the bridge
+#define health_freq 2000	// ms between health echoes
+#define health_timeout 3000	// ms without the echo after which the bridge fails over to the next broker
+#define stats_id 16			// bridge counters topic, stats_id/node_id: id,frames,bytes,max latency(ms),dropped,last outage(ms),replayed,expired,broker,echo rtt(ms),control frames,resends,lost,duplicates,max resend latency(ms)
+#define stats_freq 10000	// ms between bridge counter reports
+#define ack_id 18			// control frame acks, ack_id/<bridge id>: seq
+#define window 4			// control frames awaiting their ack
+#define ack_timeout 400	// ms before an unacknowledged control frame is resent
+#define max_tries 4		// sends of a control frame before it is counted lost
+#define dedup_depth 16	// received control frames remembered for duplicate suppression
+#define log_id 20			// telemetry the node logged while offline, replayed after reconnect
+#define op_link 22			// link state frame towards the node: 0,connected,op
+#define backoff_min 500		// ms, first MQTT reconnect delay
+#define backoff_max 30000	// ms, longest MQTT reconnect delay (doubled per failure, plus jitter)
+#define uart_rx_buffer 4096	// bytes of UART frames buffered while a broker connect blocks the loop (4 s at 9600 baud)
+#define connect_timeout 1000	// ms a TCP connect to a broker may block
+#define mqtt_timeout 2		// s PubSubClient waits for the CONNACK, a LAN broker answers in milliseconds
+#define sf_depth 8			// frames held while the broker is unreachable
+#define sf_ttl 10000		// ms a held control frame stays worth sending
+#define req_ttl 3000		// ms a held charge request stays worth sending, the node asks again anyway
+#define max_coordinators 8	// zone coordinators whose availability is cached
+#define avail_refresh 30000	// ms after which an unchanged advert is relayed again, the node ages adverts after 60 s
+#define keepalive 5			// MQTT keepalive in seconds, broker fires the last will after 1.5x
 WiFiClient espClient;		// Spawn Wifi Client 
 PubSubClient client(espClient); // Spawn MQTT Client
 long lastMsg = 0;				// Flag to send Ping Request
 char msg[50];					// local buffer to store uart messages from NODE
 int value = 0;					
 char *token;					// CSV parser buffer
-char buf3[30];					// local buffer to store ID(char)
+char buf3[100];					// local buffer to store received payload
 int ID,statt;					// local buffer to store ID(int),SOC(int)
-char buf[50];					// local buffer to store subscribe TOPIC
+char buf[100];					// local buffer to store publish payload
 int id,stat,destination;		// variable to store UART received ID(int), SOC(int), REMOTE ID(int)
 char temp_buf[100];				// local buffer
 int index1=0;					
 char buf2[20];					// buffer to store topic
+char topic_disp[10];			// precomputed dashboard topic
+char topic_stats[10];			// precomputed bridge counters topic
+bool overflow=false;			// frame longer than temp_buf, dropped up to its terminator
+unsigned long frame_start=0;	// arrival of the first byte of the current frame
+unsigned long stats_time=0;		// next bridge counter report
+unsigned long frames=0,bytes=0,max_latency=0,dropped=0;	// bridge counters of the current period
+unsigned long retry_time=0;		// next MQTT connection attempt
+unsigned long backoff=backoff_min;	// current reconnect delay
+unsigned long outage_start=0;	// broker lost, 0 while connected
+unsigned long outage=0;			// ms of the last broker outage
+unsigned long replayed=0,expired=0;	// held frames sent after reconnect / dropped (expired or evicted) in the period
+typedef struct {
+  char topic[20];				// destination topic
+  char payload[100];			// payload, not NUL terminated
+  int len;						// payload length
+  bool retained;				// publish retained
+  bool telemetry;				// latest value only, coalesced per topic and never expires
+  unsigned long expiry;			// control frames are dropped after this time
+} held_t;
+held_t held[sf_depth];			// store and forward queue, FIFO
+int held_head=0,held_count=0;	// oldest held frame, number of held frames
+int broker=0;					// index of the broker in use
+char topic_health[10];			// precomputed health echo topic
+char own_prefix[8];				// "node_id," every frame of this node starts with
+int own_len=0;					// length of own_prefix
+unsigned long health_time=0;	// next health echo
+unsigned long ping_sent=0;		// time of the pending health echo, 0 -> none pending
+unsigned long echo_rtt=0;		// round trip of the last health echo
+char topic_own[8];				// precomputed own ID topic
+char topic_ack[10];				// precomputed ack topic of this bridge
+typedef struct {
+  char topic[20];				// destination topic
+  char payload[112];			// tagged frame, not NUL terminated
+  int len;						// tagged frame length
+  unsigned int seq;				// sequence number in the tag
+  unsigned long first;			// first send
+  unsigned long sent;			// last send
+  int tries;					// sends so far, 0 -> slot free
+} inflight_t;
+inflight_t inflight[window];	// control frames awaiting their ack
+unsigned int seq=0;				// last control frame sequence number
+unsigned int boot=0;			// random per boot, sequence numbers of an earlier boot never match
+int seen_src[dedup_depth];		// recently received control frames: sender bridge
+unsigned int seen_boot[dedup_depth];	// recently received control frames: boot of the sender
+unsigned int seen_seq[dedup_depth];	// recently received control frames: sequence number
+int seen_pos=0;					// next slot to overwrite
+unsigned long ctl=0,retx=0,lost=0,dups=0,retx_latency=0;	// control frame counters of the current period
+char will_topic[10];			// last will topic (coordinator)
+char will_msg[20];				// last will payload
+char avail_buf[max_coordinators][30];	// cached charger availability payload per coordinator
+int avail_coord[max_coordinators];	// coordinator id owning each cache line
+unsigned long avail_sent[max_coordinators];	// last relay time per coordinator
+int sub_band=0;				// lowest band subscribed, all bands until the node SOC is known
+int own_soc=-1;				// latest SOC of the node, -1 until known (no objections, broadcasts reach the node as peer SOC)
+int obj_to[max_objections];	// node each scheduled objection goes to, 0 -> free slot
+int obj_band[max_objections];	// band of the objected broadcast
+unsigned long obj_due[max_objections];	// time the scheduled objection is published
+int link_up=-1;				// link state last told to the node, -1 before the first report
+unsigned long link_time=0;	// next periodic link report
 
 void setup() {
   pinMode(BUILTIN_LED, OUTPUT);     // Initialize the BUILTIN_LED pin as an output
+  Serial.setRxBufferSize(uart_rx_buffer);	// frames keep arriving while a connect attempt blocks
   Serial.begin(9600);				//intialize UART with 9600
   setup_wifi();						// wifi init
-  client.setServer(mqtt_server, 1883); // MQTT init
+  client.setServer(mqtt_servers[broker], 1883); // MQTT init
+  espClient.setTimeout(connect_timeout);	// bound the blocking part of each connect attempt
+  client.setSocketTimeout(mqtt_timeout);
+  client.setKeepAlive(keepalive);		// detect a dead bridge within seconds
+  sprintf(will_topic,"%d",lost_id);
+  sprintf(will_msg,"%d,0,%d#",node_id,op_lost); // delivered to the coordinator if this bridge dies
   client.setCallback(callback);			// MQTT setcallback on message
+  sprintf(topic_disp,"%d",disp_id);
+  sprintf(topic_stats,"%d/%d",stats_id,node_id);
+  sprintf(topic_health,"%d/%d",health_id,node_id);
+  sprintf(topic_own,"%d",node_id);
+  sprintf(topic_ack,"%d/%d",ack_id,node_id);
+  own_len=sprintf(own_prefix,"%d,",node_id);
+  randomSeed(ESP.random());				// hardware RNG, bridges must not share backoff jitter
+  boot=ESP.random()&0xFFFF;
 }
 
 void setup_wifi() {
@@ -79,10 +207,26 @@ void callback(char* topic, byte* payload, unsigned int length) {
   }
   Serial.println();
   #endif
+if(strcmp(topic,topic_health)==0){ // health echo, broker alive
+  echo_rtt=millis()-ping_sent;
+  ping_sent=0;
+  return;
+}
+if(strcmp(topic,topic_ack)==0){ // ack of one of our control frames
+  ack_received(payload,length);
+  return;
+}
+if(strcmp(topic,topic_own)==0 && (length=strip_control(payload,length))==0)
+  return; // duplicate control frame
+//own broadcast/ring frames echoed by the broker, dropped before any parsing (MQTT 3.1.1 has no no-local)
+if((strncmp(topic,"255/",4)==0 || atoi(topic)==token_id || atoi(topic)==peer_id) && length>=own_len && memcmp(payload,own_prefix,own_len)==0)
+  return;
+if(length>=sizeof(buf3)) length=sizeof(buf3)-1; // clip oversized payloads
 for(int i=0;i<length;i++)
   {
     buf3[i]=(char)payload[i];
   }
+buf3[length]='\0';
  //parse message received
 token = strtok(buf3, ",");
 ID=atoi(token);
@@ -93,13 +237,52 @@ statt=atoi(token);
 //Serial.print("Status=");
 //Serial.println(atoi(token));
 
-//network filter to block OWN broadcast message
-if(strstr(topic,"255") != NULL){
-if(ID!=node_id){
-   for (int i = 0; i < length; i++) {
-    Serial.print((char)payload[i]);
+//availability cache, the node only hears about changes and periodic refreshes
+if(atoi(topic)==avail_id && strchr(topic,'/')!=NULL){
+  int coord=atoi(strchr(topic,'/')+1);
+  int line=coord%max_coordinators;
+  bool same=avail_coord[line]==coord && strlen(avail_buf[line])==length && memcmp(avail_buf[line],payload,length)==0; // buf3 is cut up by strtok
+  if((!same || millis()-avail_sent[line]>avail_refresh) && length<sizeof(avail_buf[line])){
+    avail_coord[line]=coord;
+    avail_sent[line]=millis();
+    memcpy(avail_buf[line],payload,length);
+    avail_buf[line][length]='\0';
+    for (int i = 0; i < length; i++) {
+      Serial.print((char)payload[i]);
+    }
   }
 }
+//objections answered here, the node only hears objections to its own broadcasts
+else if(strncmp(topic,"255/",4)==0 && own_soc>=0){ // band topics only, node topics such as 2550 or 1255 are unicast
+  token = strtok(NULL, ",");
+  int op=(token!=NULL) ? atoi(token) : op_request;
+  token = strtok(NULL, ",");
+  int target=(token!=NULL) ? atoi(token) : 0;
+  if(op==op_object && target==node_id){ // objection to our broadcast, the node decides
+    for (int i = 0; i < length; i++) {
+      Serial.print((char)payload[i]);
+    }
+  }
+  else if(op==op_object && statt<=own_soc){
+    for(int i=0;i<max_objections;i++)
+      if(obj_to[i]==target)
+        obj_to[i]=0; // an equal or lower SOC already objected
+  }
+  else if(op==op_request && own_soc<statt){
+    int slot=-1;
+    bool pending=false;
+    for(int i=0;i<max_objections;i++){
+      if(obj_to[i]==ID)
+        pending=true; // repeated broadcast, keep the running delay
+      else if(obj_to[i]==0 && slot<0)
+        slot=i;
+    }
+    if(!pending && slot>=0){ // schedule the objection, the lowest SOC goes first
+      obj_to[slot]=ID;
+      obj_band[slot]=statt/band_width;
+      obj_due[slot]=millis()+own_soc*objection_slot+random(objection_jitter);
+    }
+  }
 }
 else
 {
@@ -110,76 +293,375 @@ else
 }
 
 void reconnect() {
-  // Loop until we're reconnected
-  while (!client.connected()) {
-    #ifdef debug// debug message enable Directive to enable
-    Serial.print("Attempting MQTT connection...");
+  // one attempt per backoff period, the UART keeps being drained meanwhile
+  if (outage_start==0)
+    outage_start=millis();
+  if ((long)(millis()-retry_time)<0)
+    return;
+  #ifdef debug// debug message enable Directive to enable
+  Serial.print("Attempting MQTT connection...");
+  #endif
+  if (client.connect(myname, NULL, NULL, will_topic, 0, false, will_msg, true)) { // clean session, subscriptions follow the current bands
+    #ifdef debug
+    Serial.println("COnnected Now");
     #endif
-    if (client.connect(myname)) {
-      #ifdef debug
-      Serial.println("COnnected Now");
-      #endif
-      client.subscribe("255"); // subscribe to broadcast
-      char buf_temp_sub[10];
-      String(node_id).toCharArray(buf_temp_sub,10); //subscribe to OWN ID
+    outage=millis()-outage_start;
+    outage_start=0;
+    backoff=backoff_min;
+    ping_sent=0;
+    client.subscribe(topic_health);
+    client.subscribe(topic_ack,1);
+    char buf_temp_sub[10];
+    for(int band=sub_band;band<bands;band++){ // subscribe to broadcasts of nodes we may object to
+      sprintf(buf_temp_sub,"255/%d",band);
+      client.subscribe(buf_temp_sub);
+    }
+    for(int band=0;band<=peer_top(sub_band);band++){ // needy peers at or below our SOC, for the node's peer table
+      sprintf(buf_temp_sub,"%d/%d",peer_id,band);
       client.subscribe(buf_temp_sub);
-    } else {
-      #ifdef debug// debug message enable Directive to enable
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" try again in 5 seconds");
-      #endif
-      delay(5000);
     }
+    client.subscribe(topic_own,1); //subscribe to OWN ID, control frames at QoS 1
+    String(sched_id).toCharArray(buf_temp_sub,10); //subscribe to coordinator schedule
+    client.subscribe(buf_temp_sub);
+    sprintf(buf_temp_sub,"%d/+",avail_id); //subscribe to retained availability of every zone
+    client.subscribe(buf_temp_sub);
+    String(token_id).toCharArray(buf_temp_sub,10); //subscribe to token ring
+    client.subscribe(buf_temp_sub);
+  } else {
+    #ifdef debug// debug message enable Directive to enable
+    Serial.print("failed, rc=");
+    Serial.print(client.state());
+    Serial.println(" try again later");
+    #endif
+    broker=(broker+1)%brokers; // try the next broker right away
+    client.setServer(mqtt_servers[broker], 1883);
+    if(broker==0){ // whole list failed, back off
+      retry_time=millis()+backoff+random(backoff/2); // jitter, bridges must not reconnect in lock step
+      backoff=min(backoff*2,(unsigned long)backoff_max);
+    }
+  }
+}
+void set_band(int band){
+  char buf_temp_sub[10];
+  if(band<0 || band>=bands) return;
+  for(int i=band;i<sub_band;i++){ // SOC dropped, lower broadcasts may now be objected
+    sprintf(buf_temp_sub,"255/%d",i);
+    client.subscribe(buf_temp_sub);
   }
+  for(int i=sub_band;i<band;i++){ // SOC rose, broker no longer needs to send us lower broadcasts
+    sprintf(buf_temp_sub,"255/%d",i);
+    client.unsubscribe(buf_temp_sub);
+  }
+  for(int i=peer_top(sub_band)+1;i<=peer_top(band);i++){ // SOC rose, peers up to the new band compete with us
+    sprintf(buf_temp_sub,"%d/%d",peer_id,i);
+    client.subscribe(buf_temp_sub);
+  }
+  for(int i=peer_top(band)+1;i<=peer_top(sub_band);i++){ // SOC dropped, or far above nominal, peers no longer compete
+    sprintf(buf_temp_sub,"%d/%d",peer_id,i);
+    client.unsubscribe(buf_temp_sub);
+  }
+  sub_band=band;
+}
+/*
+  highest peer band heard at own band, -1 -> none; one band of margin above the peer bands for nodes
+  negotiating early on a forecast.
+*/
+int peer_top(int band){
+  return band>peer_bands ? -1 : min(band,peer_bands-1);
 }
 void loop(){
   if (!client.connected()) {
     reconnect();
   }
-  client.loop();
-  if(Serial.available())// if message received 
+  else {
+    if(held_count>0)
+      replay();
+    client.loop();
+    retransmit();
+    if(ping_sent!=0 && millis()-ping_sent>health_timeout){ // broker stopped answering, fail over
+      client.disconnect();
+      broker=(broker+1)%brokers;
+      client.setServer(mqtt_servers[broker], 1883);
+      retry_time=millis();
+      ping_sent=0;
+    }
+    else if(ping_sent==0 && (long)(millis()-health_time)>=0){
+      health_time=millis()+health_freq;
+      ping_sent=millis();
+      client.publish(topic_health,"1");
+    }
+  }
+  if(client.connected()!=link_up || (long)(millis()-link_time)>=0){ // node logs its telemetry while we are offline
+    link_up=client.connected();
+    link_time=millis()+stats_freq;
+    sprintf(buf,"%d,%d,%d#",bridge_id,link_up,op_link);
+    Serial.print(buf);
+  }
+  for(int i=0;i<max_objections;i++){
+    if(obj_to[i]==0 || (long)(millis()-obj_due[i])<0)
+      continue;
+    sprintf(buf2,"255/%d",obj_band[i]); // scheduled objection not suppressed
+    sprintf(buf,"%d,%d,%d,%d#",node_id,own_soc,op_object,obj_to[i]);
+    client.publish(buf2,buf);
+    obj_to[i]=0;
+  }
+  while(Serial.available())// drain everything the node sent since the last pass
     {
       char c=Serial.read(); // read message
-      if(c=='#')			//if message ending detected
-        {					// now parse all message
-          if(temp_buf[0]=='$')	// Dashboard message 
-            {
-              for(int i=0;i<index1;i++)
-                {
-                  buf[i]=temp_buf[i+1];
-                  buf[i+1]='\0';
-                }
-        String(disp_id).toCharArray(buf2,10); // convert message to char array
-        client.publish(buf2,buf);  				// publish message to dashboard
-            }
-        else{
-        token = strtok(temp_buf, ","); // parse CSV
-        destination = atoi(token);
-        token = strtok(NULL, ",");
-        id = atoi(token);
-        token = strtok(NULL, ",");
-        stat = atoi(token);
-        sprintf(buf,"%d,%d#",id,stat);
-        sprintf(buf2,"%d",destination);   
-        client.publish(buf2,buf); //publish message to destination
+      if(index1==0)
+        frame_start=millis();
+      if(overflow || index1>=sizeof(temp_buf)-1)
+        {
+          overflow=(c!='#'); // oversized frame, skip to its terminator
+          index1=0;
+          if(!overflow)
+            dropped++;
+          continue;
         }
-        index1=0;
-        #ifdef debug
-        Serial.print("id=");
-        Serial.println(id);
-        Serial.print("stat=");
-        Serial.println(stat);
-        Serial.print("destination=");
-        Serial.println(destination);
-        #endif
-        //do your thing
+      temp_buf[index1++]=c;
+      if(c=='#')			//if message ending detected
+        {
+          temp_buf[index1]='\0';
+          forward_frame();
+          index1=0;
         }
-      else{
-        temp_buf[index1]=c;
-        temp_buf[index1+1]='\0';
-        index1+=1;
+    }
+  if(client.connected() && (long)(millis()-stats_time)>=0) // bridge throughput, forwarding latency, outage
+    {
+      stats_time=millis()+stats_freq;
+      sprintf(buf,"%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%d,%lu,%lu,%lu,%lu,%lu,%lu#",node_id,frames,bytes,max_latency,dropped,outage,replayed,expired,broker,echo_rtt,ctl,retx,lost,dups,retx_latency);
+      client.publish(topic_stats,buf);
+      frames=0;
+      bytes=0;
+      max_latency=0;
+      dropped=0;
+      replayed=0;
+      expired=0;
+      ctl=0;
+      retx=0;
+      lost=0;
+      dups=0;
+      retx_latency=0;
+    }
+}
+/*
+  publishes the frame in temp_buf straight from the buffer: "dest,id,stat[,op,args]#" goes to topic
+  dest (terminated in place) with the rest as payload, "$..." dashboard frames go to disp_id.
+*/
+void forward_frame(){
+  char *topic,*payload;
+  int len;
+  if(temp_buf[0]=='$')	// Dashboard message, published without the terminator
+    {
+      topic=topic_disp;
+      payload=temp_buf+1;
+      len=index1-2;
+    }
+  else{
+    payload=strchr(temp_buf, ','); // rest of the frame (id,stat[,op,args]#) is the payload
+    if(payload==NULL)
+      return;
+    *payload++='\0'; // topic as sent by the node, e.g. 5 or 255/3
+    topic=temp_buf;
+    len=index1-(payload-temp_buf);
+    destination=atoi(topic);
+    int op=op_request;
+    sscanf(payload, "%d,%d,%d", &id, &stat, &op);
+    if(id==node_id && op!=op_time && destination!=log_id){
+      own_soc=stat; // node frames carry the SOC; not a time request from older firmware (0) or a replayed old sample
+      if(stat/band_width!=sub_band)
+        set_band(stat/band_width); // own SOC moved to another band
+    }
+    #ifdef debug
+    Serial.print("id=");
+    Serial.println(id);
+    Serial.print("stat=");
+    Serial.println(stat);
+    Serial.print("destination=");
+    Serial.println(destination);
+    #endif
+    if(destination==bridge_id)
+      return;
+  }
+  char *field=strchr(payload,',');
+  unsigned long ttl=(field!=NULL && strchr(field+1,',')==NULL) ? req_ttl : sf_ttl; // charge requests (id,soc) expire early
+  send_frame(topic,payload,len,false,topic==topic_disp || atoi(topic)==peer_id,ttl); // dashboard telemetry and peer SOC are coalesced while offline
+  if(millis()-frame_start>max_latency)
+    max_latency=millis()-frame_start;
+}
+/*
+  publishes a frame, or holds it while the broker is unreachable: telemetry keeps only its latest
+  value per topic, control frames are kept for ttl and the oldest frame is evicted when full.
+*/
+void send_frame(const char *topic, const char *payload, int len, bool retained, bool telemetry, unsigned long ttl){
+  if(client.connected()){
+    publish_frame(topic,payload,len,retained);
+    frames++;
+    bytes+=len;
+    return;
+  }
+  if(len>sizeof(held[0].payload) || strlen(topic)>=sizeof(held[0].topic)){
+    expired++;
+    return;
+  }
+  int slot=-1;
+  for(int k=0;k<held_count && telemetry;k++){
+    int i=(held_head+k)%sf_depth;
+    if(held[i].telemetry && strcmp(held[i].topic,topic)==0)
+      slot=i; // coalesce, the newer value replaces the held one
+  }
+  if(slot<0){
+    if(held_count==sf_depth){ // evict the oldest frame
+      held_head=(held_head+1)%sf_depth;
+      held_count--;
+      expired++;
+    }
+    slot=(held_head+held_count)%sf_depth;
+    held_count++;
+  }
+  strcpy(held[slot].topic,topic);
+  memcpy(held[slot].payload,payload,len);
+  held[slot].len=len;
+  held[slot].retained=retained;
+  held[slot].telemetry=telemetry;
+  held[slot].expiry=millis()+ttl;
+}
+/*
+  sends the frames held during the outage in arrival order, expired control frames are dropped. Stops
+  while the in-flight window is full, the rest follows as acks free slots.
+*/
+void replay(){
+  while(held_count>0 && client.connected()){
+    held_t *f=&held[held_head];
+    if(is_control(f->topic) && window_full())
+      return;
+    held_head=(held_head+1)%sf_depth;
+    held_count--;
+    if(!f->telemetry && (long)(millis()-f->expiry)>0){
+      expired++;
+      continue;
+    }
+    publish_frame(f->topic,f->payload,f->len,f->retained);
+    replayed++;
+  }
+}
+/*
+  control frames (unicast to a node or coordinator) go out with "~<bridge id>/<boot>/<seq>" behind the frame and
+  are acknowledged by the receiving bridge on ack_id/<bridge id>. Unacknowledged ones are resent from the
+  in-flight window, duplicates are dropped on receipt, telemetry and topic broadcasts stay fire and forget.
+*/
+bool is_control(const char *topic){
+  int d=atoi(topic);
+  return strchr(topic,'/')==NULL && d!=0 && d!=255 && (d<disp_id || d>log_id);
+}
+void publish_frame(const char *topic, const char *payload, int len, bool retained){
+  if(is_control(topic) && len+20<=sizeof(inflight[0].payload) && strlen(topic)<sizeof(inflight[0].topic)){
+    int slot=0;
+    for(int i=0;i<window;i++){ // free slot, else the oldest frame gives up
+      if(inflight[i].tries==0){
+        slot=i;
+        break;
       }
+      if(inflight[i].first<inflight[slot].first)
+        slot=i;
     }
-  
+    inflight_t *f=&inflight[slot];
+    if(f->tries!=0)
+      lost++;
+    memcpy(f->payload,payload,len);
+    f->seq=++seq;
+    f->len=len+sprintf(f->payload+len,"~%d/%u/%u",node_id,boot,f->seq);
+    strcpy(f->topic,topic);
+    f->first=millis();
+    f->sent=f->first;
+    f->tries=1;
+    ctl++;
+    topic=f->topic;
+    payload=f->payload;
+    len=f->len;
+  }
+  client.beginPublish(topic,len,retained); // streamed to the broker, no intermediate copy
+  client.write((const uint8_t*)payload,len);
+  client.endPublish();
+}
+/*
+  true if every in-flight slot waits for its ack, a new control frame would push one out as lost.
+*/
+bool window_full(){
+  for(int i=0;i<window;i++)
+    if(inflight[i].tries==0)
+      return false;
+  return true;
+}
+/*
+  resends control frames whose ack is overdue, gives up after max_tries sends.
+*/
+void retransmit(){
+  for(int i=0;i<window;i++){
+    inflight_t *f=&inflight[i];
+    if(f->tries==0 || millis()-f->sent<ack_timeout)
+      continue;
+    if(f->tries>=max_tries){
+      f->tries=0;
+      lost++;
+      continue;
+    }
+    f->tries++;
+    f->sent=millis();
+    retx++;
+    client.beginPublish(f->topic,f->len,false);
+    client.write((const uint8_t*)f->payload,f->len);
+    client.endPublish();
+  }
+}
+/*
+  ack of one of our control frames, frees its in-flight slot.
+*/
+void ack_received(byte* payload, unsigned int length){
+  char tag[8];
+  if(length>=sizeof(tag)) length=sizeof(tag)-1;
+  memcpy(tag,payload,length);
+  tag[length]='\0';
+  unsigned int s=atoi(tag);
+  for(int i=0;i<window;i++){
+    if(inflight[i].tries!=0 && inflight[i].seq==s){
+      if(inflight[i].tries>1 && millis()-inflight[i].first>retx_latency)
+        retx_latency=millis()-inflight[i].first; // delivered by a resend
+      inflight[i].tries=0;
+    }
+  }
+}
+/*
+  acknowledges a received control frame and strips its tag, returns the frame length, 0 for a duplicate.
+*/
+unsigned int strip_control(byte* payload, unsigned int length){
+  unsigned int pos=0;
+  char tag[24],ack[8],ack_topic[10];
+  while(pos<length && payload[pos]!='~')
+    pos++;
+  if(pos==length || length-pos>=sizeof(tag))
+    return pos; // untagged frame
+  memcpy(tag,payload+pos+1,length-pos-1);
+  tag[length-pos-1]='\0';
+  char *slash=strchr(tag,'/');
+  char *slash2=(slash!=NULL) ? strchr(slash+1,'/') : NULL;
+  if(slash2==NULL)
+    return pos;
+  int src=atoi(tag);
+  unsigned int b=atoi(slash+1);
+  unsigned int s=atoi(slash2+1);
+  sprintf(ack_topic,"%d/%d",ack_id,src);
+  sprintf(ack,"%u",s);
+  client.publish(ack_topic,ack);
+  for(int i=0;i<dedup_depth;i++){
+    if(seen_src[i]==src && seen_boot[i]==b && seen_seq[i]==s){
+      dups++;
+      return 0; // resend of a frame already forwarded, its ack was lost
+    }
+  }
+  seen_src[seen_pos]=src;
+  seen_boot[seen_pos]=b;
+  seen_seq[seen_pos]=s;
+  seen_pos=(seen_pos+1)%dedup_depth;
+  return pos;
 }
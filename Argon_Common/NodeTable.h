@@ -0,0 +1,130 @@
+/***
+Program Name: NodeTable.h
+Purpose : Per node table shared by the NodeX and Coordinator programs.
+Description : Fixed capacity open addressing table keyed by 16 bit node id (linear probing), so a per
+                message lookup stays O(1) whatever the fleet size. Entries older than the table ttl are
+                removed with backward shift deletion, which keeps every probe chain intact without
+                tombstones; the caller sweeps a few slots per pass and a lookup drops the expired entries
+                on its own chain. Inserts are refused one slot short of full, the table size sets the load.
+                Time stamps are 16 bit node_tick counts, so a slot must be swept at least once every
+                65536 ticks (1.8 h) or an expired entry would look fresh again.
+Author: Kankan Sarkar
+Modifications : 19/10/2026-- V1.0-- Initial Creation, moved out of both main.cpp, expiry with backward shift deletion
+
+***/
+#ifndef NODE_TABLE_H
+#define NODE_TABLE_H
+
+#include "mbed.h"
+
+#define node_tick 100 // ms per table time stamp tick
+#define sweep_slots 8 // slots checked for expiry per sweep, callers sweep once per loop pass
+
+template < typename T, uint16_t size, uint32_t ttl >
+  class NodeTable {
+    private:
+      uint16_t keys[size]; // node id per slot, 0 -> empty
+    uint16_t stamps[size]; // last insert per slot, node_tick units
+    T values[size]; // entry per slot
+    uint16_t count; // held entries
+    uint16_t cursor; // next slot to sweep
+    uint16_t home(uint16_t id) {
+      return (uint32_t) id * 40503u % size; // odd multiplier, consecutive ids land on distinct slots
+    }
+    uint16_t next(uint16_t i) {
+      return i + 1 == size ? 0 : i + 1;
+    }
+    uint16_t tick(uint64_t now) {
+      return (uint16_t)(now / node_tick);
+    }
+    bool expired(uint16_t i, uint64_t now) {
+      return (uint32_t)(uint16_t)(tick(now) - stamps[i]) * node_tick > ttl;
+    }
+    void erase(uint16_t i) { // empties slot i and shifts the rest of its chain back
+      uint16_t j = i, k = next(i);
+      while (keys[k] != 0) {
+        uint16_t h = home(keys[k]);
+        bool stays = j < k ? (h > j && h <= k) : (h > j || h <= k); // home cyclically in (j, k]
+        if (!stays) {
+          keys[j] = keys[k];
+          stamps[j] = stamps[k];
+          values[j] = values[k];
+          j = k;
+        }
+        k = next(k);
+      }
+      keys[j] = 0;
+      count--;
+    }
+    public:
+      NodeTable() {
+        memset(keys, 0, sizeof(keys));
+        count = 0;
+        cursor = 0;
+      }
+    T * find(uint16_t id, uint64_t now) { // entry of the node, NULL if not held or expired
+      uint16_t i = home(id);
+      while (keys[i] != 0) {
+        if (expired(i, now)) {
+          erase(i); // the chain moved back into slot i, look at it again
+        } else if (keys[i] == id) {
+          return & values[i];
+        } else {
+          i = next(i);
+        }
+      }
+      return NULL;
+    }
+    T * insert(uint16_t id, uint64_t now) { // entry of the node, claimed if new, NULL if full
+      uint16_t i = home(id);
+      while (keys[i] != 0) {
+        if (expired(i, now)) {
+          erase(i);
+        } else if (keys[i] == id) {
+          stamps[i] = tick(now);
+          return & values[i];
+        } else {
+          i = next(i);
+        }
+      }
+      if (count >= size - 1) {
+        return NULL; // one empty slot ends every probe
+      }
+      keys[i] = id;
+      stamps[i] = tick(now);
+      count++;
+      return & values[i];
+    }
+    void remove(uint16_t id) {
+      uint16_t i = home(id);
+      while (keys[i] != 0 && keys[i] != id) {
+        i = next(i);
+      }
+      if (id != 0 && keys[i] == id) {
+        erase(i);
+      }
+    }
+    void sweep(uint64_t now) { // expires entries in the next sweep_slots slots
+      for (uint8_t n = 0; n < sweep_slots; n++) {
+        if (keys[cursor] != 0 && expired(cursor, now)) {
+          erase(cursor); // a shifted entry may have landed on the cursor, check it next pass
+        } else {
+          cursor = next(cursor);
+        }
+      }
+    }
+    uint16_t key(uint16_t i) { // node held in slot i, 0 if none
+      return keys[i];
+    }
+    uint32_t age(uint16_t i, uint64_t now) { // ms since the last insert of slot i
+      return (uint32_t)(uint16_t)(tick(now) - stamps[i]) * node_tick;
+    }
+    T * at(uint16_t i) {
+      return & values[i];
+    }
+    uint16_t get_Count() {
+      return count;
+    }
+  };
+
+#endif
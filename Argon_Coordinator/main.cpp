@@ -13,6 +13,16 @@ Modifications : 16/03/2019-- V1.0-- Initial Creation, OLED test, LED,Button Test
                 18/03/2019-- V1.2-- Integration with MQTT Broker
                 19/03/2019-- V1.2.1-- Networking test with nodes, debugging 
                 21/03/2019-- V1.3-- Final version
+                19/10/2026-- V1.4-- Charging slot reservation calendar, schedule publishing
+                19/10/2026-- V1.5-- Node depletion forecasts, charge invitations while idle
+                19/10/2026-- V1.6-- Admission stage: per node coalescing, rate limiting, load shedding
+                19/10/2026-- V1.7-- Charger leases renewed by node telemetry, release on bridge last will
+                19/10/2026-- V1.8-- Retained charger availability advertisement
+                19/10/2026-- V1.9-- Zone coordinators, one per zone with its own ID
+                19/10/2026-- V1.10-- Hot standby coordinator, replicated grant/release/queue, heartbeat failover
+                19/10/2026-- V1.11-- Flash journal of grant/release/queue events, warm restart
+                19/10/2026-- V1.12-- 16 bit node ids, hashed per node tables
+                19/10/2026-- V1.13-- Time exchange replies, the coordinator clock is the network timebase
 
 ***/
 
@@ -21,9 +31,62 @@ Modifications : 16/03/2019-- V1.0-- Initial Creation, OLED test, LED,Button Test
 #include <iostream> 
 #include <string> 
 #include "rtos.h"
+#include "../Argon_Common/NodeTable.h"
 
 //-----------------------------------------------Network Specific Message----------------------------
-uint8_t ID = 5; // Coordinator ID
+uint16_t ID = 5; // Coordinator ID, one coordinator per warehouse zone (change ID per zone)
+#define sched_id 11 // topic on which upcoming reservations are published
+#define op_request 0 // charge request (legacy frame without opcode)
+#define op_reserve 1 // reservation request: id,soc,op,start(s from now),duration(s)
+#define op_cancel 2 // cancel all reservations of the sender
+#define op_schedule 3 // schedule frame: id,0,op,count,(node,start(s from now),duration(s))*count
+#define op_forecast 4 // depletion forecast: id,soc,op,seconds to nominal threshold
+#define op_invite 5 // invitation to charge ahead of the threshold
+#define op_busy 6 // request shed by admission: id,0,op,retry after(ms)
+#define op_renew 7 // lease renewal sent by the charging node with its telemetry
+#define op_lost 8 // MQTT last will of a node bridge, the node is gone
+#define op_decline 23 // grant turned down by a node already charging at another zone: id,soc,op
+#define avail_id 12 // retained availability topic, the bridge publishes it as avail_id/ID
+#define op_avail 9 // availability: id,charging,op,queue length,lowest queued SOC
+#define avail_refresh 20000 // ms between repeats of an unchanged advert, well inside the node side avail_stale
+#define repl_id 14 // replication topic between boards sharing this ID, the bridge uses repl_id/ID
+#define op_heartbeat 10 // active board heartbeat: ID,charging node,op,board,lease left(ms)
+#define op_repl_queue 11 // request admitted: ID,node,op,board,soc
+#define op_repl_grant 12 // charger granted: ID,node,op,board
+#define op_repl_release 13 // charger released: ID,node,op,board
+#define op_repl_dequeue 14 // request left the waitlist without a grant (expired, denied, node lost): ID,node,op,board
+#define bridge_id 0 // frames for the ESP bridge itself, never published
+#define op_hold 15 // bridge holds its frames towards this board: 0,ID,0,op,ms (0 -> release them)
+#define op_role 16 // role of this board towards its bridge: 0,ID,active,op; only the active board's bridge acks control frames
+#define role_freq 5000 // ms between role frames, a restarted bridge learns the role quickly
+#define op_time 20 // time exchange: request id,soc,op,t1 (soc unused); reply ID,0,op,t1,t2 (received),t3 (replied), ms
+#define hot_standby 0 // 1 -> two boards share this ID (heartbeat, failover wait at boot), 0 -> single board, active at once
+#define board 0 // board number under this ID, 0 -> primary, 1 -> hot standby
+#define disp_id 10 // coordinator counters, the bridge publishes them as disp_id/ID apart from the node telemetry
+#define max_Reservations 16 // reservation calendar capacity
+#define sched_entries 3 // number of upcoming reservations published per schedule frame
+#define reserve_guard 60000 // ms before a reserved slot in which walk-in requests of other nodes are denied
+#define max_Nodes 12800 // forecasts tracked, 10k node ids at load below 0.8 (6 bytes per slot)
+#define forecast_none 0xFFFF // forecast of a node which is not depleting
+#define forecast_stale 120000 // ms after which a node forecast is ignored
+#define invite_horizon 1800 // s, idle charger invites nodes predicted to hit the threshold within this time
+#define invite_freq 10000 // ms between invitations while the charger is idle
+#define admit_depth 8 // pending charge requests held in front of arbitration
+#define admit_interval 1000 // ms, minimum gap between two admitted requests of one node
+#define admit_Nodes 512 // nodes admitted within admit_interval tracked for the rate limit
+#define admit_ttl 15000 // ms a pending request waits for the charger before it is dropped
+#define admit_retry 5000 // ms a shed node is told to back off when the admission stage is full
+#define stats_freq 10000 // ms between coordinator counter reports
+#define lease_ms 30000 // ms a grant stays valid without renewal from the charging node
+#define repl_hb 500 // ms between heartbeats of the active board
+#define failover_ms 2000 // ms of heartbeat silence after which a standby takes over
+#define journal_sector_a 0x080C0000 // flash sector 10 (128KB), first journal sector
+#define journal_sector_b 0x080E0000 // flash sector 11 (128KB), second journal sector
+#define journal_magic 0xA55B // marks a written journal record (16 bit node layout)
+#define journal_head 0xFF // journal sector header record, node/arg carry the generation
+#define journal_spare 64 // records left free while the compaction waits for the bridge to hold its frames
+#define hold_ms 5000 // ms the bridge holds its frames at most, the sector erase stalls the flash bus for 1-2 s
+#define hold_lead 300 // ms between the hold request and the erase, frames already on the wire are drained
 //----------------------------------------------Global Variable--------------------------------------
 char wifi_buf[200]; // buffer to store wifi messages
 int index_wifi = 0; // index to track wifi_buf char count
@@ -43,31 +106,42 @@ DigitalOut myled1(PA_7); // Onboard RED LED
 Serial pc(USBTX, USBRX); // Debug Uart
 Serial wifi(PA_2, PA_3); //Wifi Uart 
 Thread Network; //Networking Thread
+FlashIAP flash; // internal flash holding the state journal
 typedef struct {
-  uint8_t id; // id to store Remote ID
+  uint16_t id; // id to store Remote ID
   uint16_t status; //id to store Remote SOC
 }
 message_t; // Queue Message Structure
 MemoryPool < message_t, 32 > mpool; // Memory Pool for Queue message structure
 Queue < message_t, 100 > queue; // Queue init
 bool charging_Done = 0; // Charging Status
+bool active = false; // this board serves the coordinator ID, false while hot standby
+uint64_t hb_seen = 0; // last heartbeat of the active board, clock_ms() based
+uint32_t failover_time = 0; // ms from the last primary heartbeat to the takeover
 
 void Uart_to_Wifi();
 uint64_t clock_ms();
 void callback();
 void disp();
+void publish_Schedule();
+void grant_Charger(uint16_t);
+void release_Charger();
+void journal_Replay(uint8_t, uint16_t, uint8_t);
+void journal_Snapshot();
+void drop_Request(uint16_t);
 
 //------------------------------------Node Class Starts Here------------------------------------------
 // For better understanding Please refer project document.
 class Node {
   private:
-    uint8_t node_ID; // node id
+    uint16_t node_ID; // node id
   uint16_t error_State; // error state variable 1->Network Error,2->Charger Error,0->No error
   char buf[200]; // local buffer
   bool charging; // charging status
-  uint8_t node_Charging; // Charging Node ID(Remote)
+  uint16_t node_Charging; // Charging Node ID(Remote)
+  uint64_t lease; // charger grant expiry, clock_ms() based
   public:
-    Node(uint8_t id) {
+    Node(uint16_t id) {
       node_ID = id;
     }
   void set_Charging(bool status) {
@@ -82,15 +156,21 @@ class Node {
   uint8_t get_Error() {
     return error_State;
   }
-  uint8_t get_nodeID() {
+  uint16_t get_nodeID() {
     return node_ID;
   }
-  void set_NodeCharging(uint8_t id) { // stores which node is getting charged.
+  void set_NodeCharging(uint16_t id) { // stores which node is getting charged.
     node_Charging = id;
   }
-  uint8_t get_NodeCharging() { // returns which node is getting charged.
+  uint16_t get_NodeCharging() { // returns which node is getting charged.
     return node_Charging;
   }
+  void set_Lease(uint64_t expiry) { // grant is valid until expiry
+    lease = expiry;
+  }
+  uint64_t get_Lease() {
+    return lease;
+  }
   char * get_Status() // dashboard specific message
   {
     sprintf(buf, "%d,%d,%d", node_ID, node_Charging, error_State);
@@ -98,6 +178,384 @@ class Node {
   }
 };
 
+//------------------------------------Calendar Class Starts Here--------------------------------------
+// Reserved charger slots are kept sorted by start time and never overlap, so the end times are sorted
+// as well and every lookup is a binary search over the slot array.
+typedef struct {
+  uint64_t start; // slot start, clock_ms() based
+  uint64_t end; // slot end (exclusive), clock_ms() based
+  uint16_t id; // node owning the slot
+}
+slot_t;
+
+class Calendar {
+  private:
+    slot_t slots[max_Reservations]; // sorted, non overlapping reservations
+  uint8_t count; // number of valid slots
+  uint8_t first_Ending_After(uint64_t t) { // index of the first slot with end > t
+    uint8_t lo = 0, hi = count;
+    while (lo < hi) {
+      uint8_t mid = (lo + hi) / 2;
+      if (slots[mid].end > t) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    return lo;
+  }
+  void remove(uint8_t i) {
+    memmove( & slots[i], & slots[i + 1], (count - i - 1) * sizeof(slot_t));
+    count--;
+  }
+  public:
+    Calendar() {
+      count = 0;
+    }
+  bool reserve(uint16_t id, uint64_t start, uint64_t end) { // books [start,end) if free, false on conflict or full
+    uint8_t i = first_Ending_After(start);
+    if (count == max_Reservations || end <= start || (i < count && slots[i].start < end)) {
+      return false;
+    }
+    memmove( & slots[i + 1], & slots[i], (count - i) * sizeof(slot_t));
+    slots[i].start = start;
+    slots[i].end = end;
+    slots[i].id = id;
+    count++;
+    return true;
+  }
+  uint16_t owner_Between(uint64_t start, uint64_t end) { // owner of the first slot overlapping [start,end), 0 if none
+    uint8_t i = first_Ending_After(start);
+    if (i < count && slots[i].start < end) {
+      return slots[i].id;
+    }
+    return 0;
+  }
+  bool cancel(uint16_t id) { // drops every slot of the node
+    bool found = false;
+    for (uint8_t i = count; i > 0; i--) {
+      if (slots[i - 1].id == id) {
+        remove(i - 1);
+        found = true;
+      }
+    }
+    return found;
+  }
+  bool consume(uint16_t id, uint64_t now) { // drops the running slot of the node once its charge is over
+    uint8_t i = first_Ending_After(now);
+    if (i < count && slots[i].start <= now && slots[i].id == id) {
+      remove(i);
+      return true;
+    }
+    return false;
+  }
+  bool expire(uint64_t now) { // drops the slots which are over
+    uint8_t n = first_Ending_After(now);
+    if (n == 0) {
+      return false;
+    }
+    memmove( & slots[0], & slots[n], (count - n) * sizeof(slot_t));
+    count -= n;
+    return true;
+  }
+  uint8_t get_Count() {
+    return count;
+  }
+  slot_t * get_Slot(uint8_t i) {
+    return & slots[i];
+  }
+};
+
+//------------------------------------Forecasts Class Starts Here-------------------------------------
+// Latest depletion forecast of every node, used to hand an idle charger to the forklift which will
+// need it first instead of waiting for several of them to trip the threshold together.
+class Forecasts {
+  private:
+    NodeTable < uint16_t, max_Nodes, forecast_stale > table; // seconds to nominal threshold per node when reported
+  public:
+  void update(uint16_t id, uint16_t ttc, uint64_t now) {
+    uint16_t * f = table.insert(id, now);
+    if (f != NULL) {
+      * f = ttc;
+    }
+  }
+  void clear(uint16_t id) {
+    table.remove(id);
+  }
+  void sweep(uint64_t now) {
+    table.sweep(now);
+  }
+  uint16_t most_Urgent(uint64_t now, uint16_t horizon) { // node with the nearest predicted threshold within horizon, 0 if none
+    uint16_t id = 0;
+    uint32_t best = horizon;
+    for (uint16_t i = 0; i < max_Nodes; i++) {
+      uint16_t ttc = * table.at(i);
+      uint32_t age = table.age(i, now);
+      if (table.key(i) == 0 || ttc == forecast_none || age > forecast_stale) {
+        continue;
+      }
+      uint32_t left = ttc > age / 1000 ? ttc - age / 1000 : 0;
+      if (left < best) {
+        best = left;
+        id = table.key(i);
+      }
+    }
+    return id;
+  }
+};
+
+//------------------------------------Admission Class Starts Here-------------------------------------
+// Bounded stage in front of arbitration. Nodes retry on the broadcast path and directly to the
+// coordinator, so the same request shows up many times; repeats are coalesced into one pending entry
+// per node (latest SOC wins), new requests are rate limited per node and anything beyond admit_depth
+// is shed with a retry-after hint instead of being silently dropped.
+typedef struct {
+  uint16_t id; // requesting node
+  uint8_t soc; // latest SOC reported by the node
+  uint64_t arrived; // last time the node asked, clock_ms() based
+}
+request_t;
+
+class Admission {
+  private:
+    request_t pending[admit_depth]; // admitted requests waiting for arbitration
+  uint8_t count; // number of pending requests
+  NodeTable < uint16_t, admit_Nodes, admit_interval > admitted; // low 16 bits of the last admission time per node
+  uint32_t accepted; // requests admitted
+  uint32_t coalesced; // repeats folded into a pending request
+  uint32_t shed; // requests rejected with a retry-after hint
+  int8_t find(uint16_t id) {
+    for (uint8_t i = 0; i < count; i++) {
+      if (pending[i].id == id) {
+        return i;
+      }
+    }
+    return -1;
+  }
+  void remove(uint8_t i) {
+    pending[i] = pending[count - 1];
+    count--;
+  }
+  public:
+    Admission() {
+      count = 0;
+      accepted = 0;
+      coalesced = 0;
+      shed = 0;
+    }
+  void restore(uint16_t id, uint8_t soc, uint64_t now) { // replicated admission from the active board
+    int8_t i = find(id);
+    if (i < 0) {
+      if (count == admit_depth) {
+        return;
+      }
+      i = count++;
+      pending[i].id = id;
+    }
+    pending[i].soc = soc;
+    pending[i].arrived = now;
+  }
+  uint32_t offer(uint16_t id, uint8_t soc, uint64_t now) { // 0 if admitted or coalesced, else ms to back off
+    int8_t i = find(id);
+    uint16_t * last = admitted.find(id, now);
+    if (i >= 0) {
+      pending[i].soc = soc;
+      pending[i].arrived = now;
+      coalesced++;
+      return 0;
+    }
+    if (last != NULL && (uint16_t)((uint16_t) now - * last) < admit_interval) {
+      shed++;
+      return admit_interval - (uint16_t)((uint16_t) now - * last);
+    }
+    if (count == admit_depth) {
+      shed++;
+      return admit_retry;
+    }
+    pending[count].id = id;
+    pending[count].soc = soc;
+    pending[count].arrived = now;
+    count++;
+    if ((last = admitted.insert(id, now)) != NULL) {
+      * last = (uint16_t) now;
+    }
+    accepted++;
+    return 0;
+  }
+  bool take(uint16_t id, request_t * req) { // removes the pending request of a node
+    int8_t i = find(id);
+    if (i < 0) {
+      return false;
+    }
+    * req = pending[i];
+    remove(i);
+    return true;
+  }
+  bool take_Neediest(request_t * req) { // removes the pending request with the lowest SOC
+    if (count == 0) {
+      return false;
+    }
+    uint8_t best = 0;
+    for (uint8_t i = 1; i < count; i++) {
+      if (pending[i].soc < pending[best].soc) {
+        best = i;
+      }
+    }
+    * req = pending[best];
+    remove(best);
+    return true;
+  }
+  void sweep(uint64_t now) {
+    admitted.sweep(now);
+  }
+  bool expire(uint64_t now, request_t * req) { // removes one request whose node stopped asking, false if none
+    for (uint8_t i = count; i > 0; i--) {
+      if (now - pending[i - 1].arrived > admit_ttl) {
+        * req = pending[i - 1];
+        remove(i - 1);
+        return true;
+      }
+    }
+    return false;
+  }
+  uint8_t get_Count() {
+    return count;
+  }
+  void get_Pending(uint8_t i, request_t * req) {
+    * req = pending[i];
+  }
+  uint8_t get_Min_Soc() { // lowest SOC waiting, 100 when nobody waits
+    uint8_t soc = 100;
+    for (uint8_t i = 0; i < count; i++) {
+      if (pending[i].soc < soc) {
+        soc = pending[i].soc;
+      }
+    }
+    return soc;
+  }
+  uint32_t get_Accepted() {
+    return accepted;
+  }
+  uint32_t get_Coalesced() {
+    return coalesced;
+  }
+  uint32_t get_Shed() {
+    return shed;
+  }
+};
+
+//------------------------------------Journal Class Starts Here---------------------------------------
+// Append only log of state changes in two flash sectors used in turn. Records are written in order
+// until the sector is full, then the other sector is erased, stamped with the next generation and
+// seeded with a snapshot of the live state, so each sector is erased only every other compaction.
+// At boot the newest generation is replayed record by record until the first erased slot. The erase
+// stalls the flash bus, so the network thread compacts once the bridge holds its frames (see full()).
+typedef struct {
+  uint16_t magic; // journal_magic once written
+  uint8_t op; // replication opcode of the event
+  uint8_t gen; // low byte of the sector generation, stale sector data never matches
+  uint16_t node; // node the event refers to (generation in the sector header)
+  uint8_t arg; // event argument (SOC for queue events)
+  uint8_t check; // xor of the bytes above
+}
+record_t;
+
+class Journal {
+  private:
+    uint32_t sector; // active sector address
+  uint32_t offset; // next free record offset in the active sector
+  uint32_t size; // sector size
+  uint16_t gen; // active sector generation
+  bool ready; // flash initialised and mounted
+  uint8_t checksum(record_t * r) {
+    uint8_t * b = (uint8_t * ) r;
+    uint8_t x = 0;
+    for (uint8_t i = 0; i < sizeof(record_t) - 1; i++) {
+      x ^= b[i];
+    }
+    return x;
+  }
+  bool valid(record_t * r) {
+    return r -> magic == journal_magic && r -> check == checksum(r);
+  }
+  bool header(uint32_t addr, uint16_t * g) { // reads a sector header, false if the sector is not a journal
+    record_t r;
+    flash.read( & r, addr, sizeof(r));
+    if (!valid( & r) || r.op != journal_head) {
+      return false;
+    }
+    * g = r.node;
+    return true;
+  }
+  void program(uint8_t op, uint16_t node, uint8_t arg) {
+    record_t r;
+    r.magic = journal_magic;
+    r.op = op;
+    r.node = node;
+    r.arg = arg;
+    r.gen = gen;
+    r.check = checksum( & r);
+    flash.program( & r, sector + offset, sizeof(r));
+    offset += sizeof(r);
+  }
+  void start(uint32_t addr, uint16_t g) { // erases a sector and makes it the active one
+    flash.erase(addr, size);
+    sector = addr;
+    offset = 0;
+    gen = g;
+    program(journal_head, g, 0);
+  }
+  public:
+    Journal() {
+      ready = false;
+    }
+  void mount(void( * replay)(uint8_t, uint16_t, uint8_t)) { // finds the newest sector and replays it
+    uint16_t ga = 0, gb = 0;
+    record_t r;
+    if (flash.init() != 0) {
+      return;
+    }
+    size = flash.get_sector_size(journal_sector_a);
+    bool a = header(journal_sector_a, & ga);
+    bool b = header(journal_sector_b, & gb);
+    ready = true;
+    if (!a && !b) { // blank flash, start the first generation
+      start(journal_sector_a, 1);
+      return;
+    }
+    if (a && (!b || (int16_t)(ga - gb) > 0)) {
+      sector = journal_sector_a;
+      gen = ga;
+    } else {
+      sector = journal_sector_b;
+      gen = gb;
+    }
+    for (offset = sizeof(r); offset + sizeof(r) <= size; offset += sizeof(r)) {
+      flash.read( & r, sector + offset, sizeof(r));
+      if (!valid( & r) || r.gen != (gen & 0xFF)) {
+        break; // first erased or torn record ends the log
+      }
+      replay(r.op, r.node, r.arg);
+    }
+  }
+  bool full() { // only the spare records are left, time to compact
+    return ready && offset + journal_spare * sizeof(record_t) > size;
+  }
+  void compact() { // into the other sector
+    start(sector == journal_sector_a ? journal_sector_b : journal_sector_a, gen + 1);
+    journal_Snapshot();
+  }
+  void append(uint8_t op, uint16_t node, uint8_t arg) {
+    if (!ready) {
+      return;
+    }
+    if (offset + sizeof(record_t) > size) { // spare records used up, compact without waiting
+      compact();
+    }
+    program(op, node, arg);
+  }
+};
+
 class I2CPreInit: public I2C // I2C abstraction for OLED
 {
   public: I2CPreInit(PinName sda, PinName scl): I2C(sda, scl) {};
@@ -106,11 +564,16 @@ class I2CPreInit: public I2C // I2C abstraction for OLED
 I2CPreInit gI2C(PC_9, PA_8); // init I2C3 
 Adafruit_SSD1306_I2c gOled2(gI2C, PE_8); // OLED Spawn 
 Node coordinator(ID);
+Calendar calendar; // reserved charger slots
+Forecasts forecasts; // node depletion forecasts
+Admission admission; // charge request admission stage
+Journal journal; // flash journal of the coordinator state
 int main() {
 
   Release.mode(PullUp); // button pullup
   wifi.baud(9600); // uart communication with ESP8266 
   pc.baud(9600); // uart DEBUG
+  journal.mount(journal_Replay); // warm restart, resume the assignment and waitlist before networking
   Network.start(Uart_to_Wifi); // Start Networking Thread
   if (coordinator.get_Charging()) { //if the coordinator is already charging display the same
     gOled2.setTextCursor(0, 0);
@@ -145,40 +608,137 @@ void Uart_to_Wifi() {
   //local varaibles
   char c; // variable to store one char received from ESP8266
   char local_buf[10]; // local buffer to store ID/SOC/Destination
-  uint8_t id = 0; // local variable to store remote ID
-  uint8_t stat = 0; // local variable to store remote SOC
+  uint16_t id = 0; // local variable to store remote ID
+  uint16_t stat = 0; // local variable to store remote SOC (node id on the replication stream)
+  uint8_t op = 0; // local variable to store message opcode
+  uint32_t arg1 = 0, arg2 = 0; // local variables to store opcode arguments
+  uint16_t owner = 0; // reservation owner
+  uint32_t retry = 0; // back off time of a shed request
+  request_t req; // request taken from the admission stage
+  uint32_t advert = 0xFFFFFFFF; // last advertised charger state
   char * token; //char array for CSV parsing
-  unsigned long time_t3 = clock_ms(), time_t4 = clock_ms(); // timer variables
+  uint64_t rx_time = 0; // arrival of the current frame, time exchange
+  uint64_t hold_sent = 0; // bridge asked to hold its frames for a compaction, 0 -> not asked
+  uint64_t time_t3 = clock_ms(), time_t4 = clock_ms(), time_t5 = clock_ms(), time_t6 = clock_ms(), time_t7 = clock_ms(); // timer variables, clock_ms() based
+  hb_seen = clock_ms() + board * failover_ms; // at boot the standby gives the primary a head start
   while (true) {
+    if (!active && (!hot_standby || clock_ms() > hb_seen + failover_ms)) { // no active board, take over the coordinator ID
+      active = true;
+      failover_time = hot_standby ? clock_ms() - hb_seen : 0;
+      coordinator.set_Lease(clock_ms() + lease_ms); // give the charging node time to find the new board
+      advert = 0xFFFFFFFF; // republish availability
+      if (coordinator.get_Charging()) { // confirm the restored/replicated grant before the node gives up
+        wifi.printf("%d,%d,%d#", coordinator.get_NodeCharging(), coordinator.get_nodeID(), coordinator.get_Charging());
+      }
+      time_t7 = 0; // tell the bridge at once
+      pc.printf("Board %d active, failover %lums\n", board, (unsigned long) failover_time); // debug
+      disp();
+    }
+    if (clock_ms() > time_t7) { // role towards the bridge
+      time_t7 = clock_ms() + role_freq;
+      wifi.printf("%d,%d,%d,%d#", bridge_id, coordinator.get_nodeID(), active, op_role);
+    }
+    if (hot_standby && active && clock_ms() > time_t3) { // heartbeat with the current assignment
+      time_t3 = clock_ms() + repl_hb;
+      wifi.printf("%d,%d,%d,%d,%d,%lu#", repl_id, coordinator.get_nodeID(), coordinator.get_Charging() ? coordinator.get_NodeCharging() : 0, op_heartbeat, board, (unsigned long)(coordinator.get_Charging() && coordinator.get_Lease() > clock_ms() ? coordinator.get_Lease() - clock_ms() : 0));
+    }
+    if (active && clock_ms() > time_t4) { // coordinator counters for the dashboard
+      time_t4 = clock_ms() + stats_freq;
+      wifi.printf("%d,%s,%lu,%lu,%lu,%d,%lu#", disp_id, coordinator.get_Status(), (unsigned long) admission.get_Accepted(), (unsigned long) admission.get_Coalesced(), (unsigned long) admission.get_Shed(), admission.get_Count(), (unsigned long) failover_time);
+    }
+    if (journal.full() && hold_sent == 0) { // ask the bridge to hold its frames over the sector erase
+      wifi.printf("%d,%d,0,%d,%d#", bridge_id, coordinator.get_nodeID(), op_hold, hold_ms);
+      hold_sent = clock_ms();
+    } else if (hold_sent != 0 && clock_ms() > hold_sent + hold_lead && index == 0 && !wifi.readable()) {
+      journal.compact(); // no frame in flight, nothing is overrun while the flash bus stalls
+      wifi.printf("%d,%d,0,%d,0#", bridge_id, coordinator.get_nodeID(), op_hold);
+      hold_sent = 0;
+    }
+    forecasts.sweep(clock_ms()); // per node tables, expired entries leave a few slots per pass
+    admission.sweep(clock_ms());
     if (wifi.readable() == true) { // if message available
       c = wifi.getc();
       if (c == '#') {
         index = 0; // message is received fully now parse the commad
+        rx_time = clock_ms();
         token = strtok(_recv_buf, ",");
         id = atoi(token);
         token = strtok(NULL, ",");
         stat = atoi(token);
-        if (coordinator.get_Charging()) {
-          // do nothing already busy charging.
-          if (id == coordinator.get_NodeCharging()) {
-            wifi.printf("%d,%d,%d#", id, coordinator.get_nodeID(), coordinator.get_Charging()); // send denial to requesting node 
+        op = op_request; // legacy frames carry no opcode
+        arg1 = 0;
+        arg2 = 0;
+        if ((token = strtok(NULL, ",")) != NULL) op = atoi(token);
+        if ((token = strtok(NULL, ",")) != NULL) arg1 = strtoul(token, NULL, 10);
+        if ((token = strtok(NULL, ",")) != NULL) arg2 = strtoul(token, NULL, 10);
+        if (op >= op_heartbeat && op <= op_repl_dequeue) { // replication stream, stat carries the node
+          if (arg1 == board) {
+            // own frame echoed by the broker
+          } else if (op == op_heartbeat) {
+            hb_seen = clock_ms();
+            if (active && arg1 < board) { // two active boards, the lower board number keeps the ID
+              active = false;
+              time_t7 = 0;
+              pc.printf("Board %d back to standby\n", board); // debug
+            }
+            if (!active) { // follow the assignment of the active board
+              if (stat != 0 && (!coordinator.get_Charging() || coordinator.get_NodeCharging() != stat)) {
+                journal.append(op_repl_grant, stat, 0); // the grant event itself was lost on the way
+              } else if (stat == 0 && coordinator.get_Charging()) {
+                journal.append(op_repl_release, coordinator.get_NodeCharging(), 0);
+              }
+              coordinator.set_Charging(stat != 0);
+              if (stat != 0) {
+                coordinator.set_NodeCharging(stat);
+                coordinator.set_Lease(clock_ms() + arg2);
+              }
+            }
+          } else if (!active) { // apply and journal the event, a restart of this board resumes the same state
+            journal_Replay(op, stat, arg2);
+            journal.append(op, stat, op == op_repl_queue ? arg2 : 0);
+          }
+        } else if (!active) {
+          // hot standby, the active board serves the nodes
+        } else if (op == op_time) { // nodes and dashboard estimate their offset to this clock
+          wifi.printf("%d,%d,0,%d,%lu,%lu,%lu#", id, coordinator.get_nodeID(), op_time, (unsigned long) arg1, (unsigned long)(uint32_t) rx_time, (unsigned long)(uint32_t) clock_ms());
+        } else if (op == op_reserve) { // book [now+arg1, now+arg1+arg2) seconds
+          stat = calendar.reserve(id, clock_ms() + arg1 * 1000ULL, clock_ms() + (arg1 + arg2) * 1000ULL);
+          wifi.printf("%d,%d,%d,%d,%lu,%lu#", id, coordinator.get_nodeID(), stat, op_reserve, (unsigned long) arg1, (unsigned long) arg2); // reservation ack/denial
+          if (stat) {
+            publish_Schedule();
+          }
+        } else if (op == op_renew) {
+          if (coordinator.get_Charging() && id == coordinator.get_NodeCharging()) {
+            coordinator.set_Lease(clock_ms() + lease_ms);
+          } else { // lease gone, its release was lost on the way, repeat it
+            wifi.printf("%d,%d,%d#", id, coordinator.get_nodeID(), 0);
+          }
+        } else if (op == op_lost) { // node bridge dropped off the broker
+          if (admission.take(id, & req)) {
+            drop_Request(id);
+          }
+          forecasts.clear(id);
+          if (coordinator.get_Charging() && id == coordinator.get_NodeCharging()) {
+            release_Charger();
+          }
+        } else if (op == op_decline) {
+          if (coordinator.get_Charging() && id == coordinator.get_NodeCharging()) {
+            release_Charger(); // free it for the next waiter now, not at lease expiry
+          }
+        } else if (op == op_forecast) {
+          forecasts.update(id, arg1, clock_ms());
+        } else if (op == op_cancel) {
+          if (calendar.cancel(id)) {
+            publish_Schedule();
+          }
+        } else {
+          retry = admission.offer(id, stat, clock_ms());
+          if (retry != 0) { // shed, tell the node when to come back
+            wifi.printf("%d,%d,0,%d,%lu#", id, coordinator.get_nodeID(), op_busy, (unsigned long) retry);
+          } else { // replicate the waitlist to the standby
+            wifi.printf("%d,%d,%d,%d,%d,%d#", repl_id, coordinator.get_nodeID(), id, op_repl_queue, board, stat);
+            journal.append(op_repl_queue, id, stat);
           }
-        } else { // serve the requesting node if charger is free
-          coordinator.set_NodeCharging(id);
-          coordinator.set_Charging(true);
-          wifi.printf("%d,%d,%d#", id, coordinator.get_nodeID(), coordinator.get_Charging()); // send charging ack to requesting node.
-          gOled2.clearDisplay(); // clear OLED
-          gOled2.setTextCursor(0, 0); // First Line
-          gOled2.printf("Status Charging"); // Display "Status Charging"
-          gOled2.setTextCursor(0, 8); // goto Next Line
-          gOled2.printf("Node ID=%d", coordinator.get_NodeCharging()); // Display Node id and charging status
-          gOled2.display(); // display on oled
-          gOled2.clearDisplay();
-          gOled2.setTextCursor(0, 0);
-          gOled2.printf("Status Charging");
-          gOled2.setTextCursor(0, 8);
-          gOled2.printf("Node ID=%d", coordinator.get_NodeCharging());
-          gOled2.display();
         }
       } else {
         //message reception is not done............ fill the buffer :(
@@ -187,20 +747,59 @@ void Uart_to_Wifi() {
         index += 1;
       }
     }
+    if (!active) {
+      continue; // standby only follows the replication stream
+    }
+
+    while (admission.expire(clock_ms(), & req)) {
+      drop_Request(req.id);
+    }
+    if (coordinator.get_Charging()) {
+      // already busy charging, other requests wait in the admission stage.
+      if (admission.take(coordinator.get_NodeCharging(), & req)) {
+        wifi.printf("%d,%d,%d#", req.id, coordinator.get_nodeID(), coordinator.get_Charging()); // repeat ack to the charging node
+        drop_Request(req.id);
+      }
+    } else if (admission.take_Neediest( & req)) {
+      owner = calendar.owner_Between(clock_ms(), clock_ms() + reserve_guard);
+      if (owner != 0 && owner != req.id) { // charger is reserved for another node
+        wifi.printf("%d,%d,%d#", req.id, coordinator.get_nodeID(), 0); // send denial to requesting node
+        drop_Request(req.id);
+      } else { // serve the neediest requesting node if charger is free
+        grant_Charger(req.id);
+      }
+    }
+
+    if (advert != (uint32_t)((coordinator.get_Charging() << 16) | (admission.get_Count() << 8) | admission.get_Min_Soc()) || clock_ms() > time_t6) {
+      advert = (coordinator.get_Charging() << 16) | (admission.get_Count() << 8) | admission.get_Min_Soc();
+      time_t6 = clock_ms() + avail_refresh; // a busy charger keeps its advert alive on the nodes
+      wifi.printf("%d,%d,%d,%d,%d,%d#", avail_id, coordinator.get_nodeID(), coordinator.get_Charging(), op_avail, admission.get_Count(), admission.get_Min_Soc()); // retained by the bridge
+    }
+
+    if (calendar.expire(clock_ms())) { // drop finished reservations
+      publish_Schedule();
+    }
+    if (!coordinator.get_Charging()) { // hand the charger to the owner of the running reservation
+      owner = calendar.owner_Between(clock_ms(), clock_ms() + 1);
+      if (owner != 0) {
+        grant_Charger(owner);
+      } else if (clock_ms() > time_t5 && calendar.owner_Between(clock_ms(), clock_ms() + reserve_guard) == 0) {
+        time_t5 = clock_ms() + invite_freq;
+        owner = forecasts.most_Urgent(clock_ms(), invite_horizon);
+        if (owner != 0) { // invite the node predicted to need the charger first
+          wifi.printf("%d,%d,0,%d#", owner, coordinator.get_nodeID(), op_invite);
+        }
+      }
+    }
 
     if (charging_Done) {
       //charging done
-      coordinator.set_Charging(false);
       charging_Done = false;
-      wifi.printf("%d,%d,%d#", coordinator.get_NodeCharging(), coordinator.get_nodeID(), coordinator.get_Charging()); // send charger release statement to remote node
-      gOled2.clearDisplay(); // display idle in OLED
-      gOled2.setTextCursor(0, 0);
-      gOled2.printf("Status Idle\n");
-      gOled2.display();
-      gOled2.clearDisplay();
-      gOled2.setTextCursor(0, 0);
-      gOled2.printf("Status Idle\n");
-      gOled2.display();
+      if (coordinator.get_Charging()) {
+        release_Charger();
+      }
+    } else if (coordinator.get_Charging() && clock_ms() > coordinator.get_Lease()) {
+      release_Charger(); // charging node went silent, free the charger for the next waiter
     }
   }
 }
@@ -211,13 +810,141 @@ Base function type: User defined function.
 Return: returns unsigned long
 Functionality:
 •   Returns system on time in milliseconds.
+•   Read from the 64 bit microsecond ticker, so it does not wrap after 71 minutes like us_ticker_read().
 
 */
 uint64_t clock_ms() {
-  return us_ticker_read() / 1000;
+  return ticker_read_us(get_us_ticker_data()) / 1000;
+}
+/*
+Function Name: grant_Charger()
+Input: id of the node to charge
+Base function type: User defined function.
+Return: N/A
+Functionality:
+•   Hands the charger to the node with a fresh lease and acknowledges it.
+*/
+void grant_Charger(uint16_t id) {
+  coordinator.set_NodeCharging(id);
+  coordinator.set_Charging(true);
+  coordinator.set_Lease(clock_ms() + lease_ms);
+  forecasts.clear(id);
+  wifi.printf("%d,%d,%d#", id, coordinator.get_nodeID(), coordinator.get_Charging()); // send charging ack to the node.
+  wifi.printf("%d,%d,%d,%d,%d#", repl_id, coordinator.get_nodeID(), id, op_repl_grant, board); // replicate to the standby
+  journal.append(op_repl_grant, id, 0);
+  disp();
+}
+/*
+Function Name: release_Charger()
+Input: N/A
+Base function type: User defined function.
+Return: N/A
+Functionality:
+•   Frees the charger, tells the charging node and consumes its running reservation.
+*/
+void release_Charger() {
+  coordinator.set_Charging(false);
+  wifi.printf("%d,%d,%d#", coordinator.get_NodeCharging(), coordinator.get_nodeID(), coordinator.get_Charging()); // send charger release statement to remote node
+  wifi.printf("%d,%d,%d,%d,%d#", repl_id, coordinator.get_nodeID(), coordinator.get_NodeCharging(), op_repl_release, board); // replicate to the standby
+  journal.append(op_repl_release, coordinator.get_NodeCharging(), 0);
+  if (calendar.consume(coordinator.get_NodeCharging(), clock_ms())) { // reservation consumed
+    publish_Schedule();
+  }
+  disp();
 }
+/*
+Function Name: journal_Replay()
+Input: journal record opcode, node, argument
+Base function type: User defined function, invoked by Journal::mount() at boot and for the replication stream on the standby.
+Return: N/A
+Functionality:
+•   Applies one journalled event to the coordinator state.
+*/
+void journal_Replay(uint8_t op, uint16_t node, uint8_t arg) {
+  request_t req;
+  if (op == op_repl_queue) {
+    admission.restore(node, arg, clock_ms());
+  } else if (op == op_repl_grant) {
+    admission.take(node, & req);
+    coordinator.set_NodeCharging(node);
+    coordinator.set_Charging(true);
+    coordinator.set_Lease(clock_ms() + lease_ms); // lease restarts with the board
+  } else if (op == op_repl_release) {
+    coordinator.set_Charging(false);
+  } else if (op == op_repl_dequeue) {
+    admission.take(node, & req);
+  }
+}
+/*
+Function Name: drop_Request()
+Input: id of the node whose request left the waitlist without a grant
+Base function type: User defined function.
+Return: N/A
+Functionality:
+•   Replicates and journals the removal, so neither the standby nor a warm restart brings the request back.
+*/
+void drop_Request(uint16_t id) {
+  wifi.printf("%d,%d,%d,%d,%d#", repl_id, coordinator.get_nodeID(), id, op_repl_dequeue, board); // replicate to the standby
+  journal.append(op_repl_dequeue, id, 0);
+}
+/*
+Function Name: journal_Snapshot()
+Input: N/A
+Base function type: User defined function, invoked by Journal::append() on compaction.
+Return: N/A
+Functionality:
+•   Writes the live assignment and waitlist as the first records of a fresh journal sector.
+*/
+void journal_Snapshot() {
+  request_t req;
+  if (coordinator.get_Charging()) {
+    journal.append(op_repl_grant, coordinator.get_NodeCharging(), 0);
+  }
+  for (uint8_t i = 0; i < admission.get_Count(); i++) {
+    admission.get_Pending(i, & req);
+    journal.append(op_repl_queue, req.id, req.soc);
+  }
+}
+/*
+Function Name: disp()
+Input: N/A
+Base function type: User defined function.
+Return: N/A
+Functionality:
+•   Shows the charger status and the charging node on the OLED.
+*/
 void disp() {
-
+  for (uint8_t i = 0; i < 2; i++) { // drawn twice, the first frame after clearDisplay() is not always latched
+    gOled2.clearDisplay();
+    gOled2.setTextCursor(0, 0);
+    if (coordinator.get_Charging()) {
+      gOled2.printf("Status Charging");
+      gOled2.setTextCursor(0, 8);
+      gOled2.printf("Node ID=%d", coordinator.get_NodeCharging());
+    } else {
+      gOled2.printf("Status Idle\n");
+    }
+    gOled2.display();
+  }
+}
+/*
+Function Name: publish_Schedule()
+Input: N/A
+Base function type: User defined function.
+Return: N/A
+Functionality:
+•   Publishes the next reservations on the schedule topic as
+    "sched_id,ID,0,op_schedule,count,node,start(s from now),duration(s),..." so nodes can plan ahead.
+*/
+void publish_Schedule() {
+  uint64_t now = clock_ms();
+  uint8_t n = calendar.get_Count() < sched_entries ? calendar.get_Count() : sched_entries;
+  wifi.printf("%d,%d,0,%d,%d", sched_id, coordinator.get_nodeID(), op_schedule, n);
+  for (uint8_t i = 0; i < n; i++) {
+    slot_t * slot = calendar.get_Slot(i);
+    wifi.printf(",%d,%lu,%lu", slot -> id, (unsigned long)(slot -> start > now ? (slot -> start - now) / 1000 : 0), (unsigned long)((slot -> end - slot -> start) / 1000));
+  }
+  wifi.printf("#");
 }
 void callback() {
   charging_Done = true;
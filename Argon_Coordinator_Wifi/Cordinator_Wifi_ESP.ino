@@ -8,6 +8,17 @@ Description : In warehouses , there may be many battery powered forklifts, but l
 Author: Kankan Sarkar
 Modifications : 17/01/2018-- V1.0-- Initial Creation, MQTT Test, UART TEST
                 21/03/2019-- V1.2-- Final version
+                19/10/2026-- V1.3-- Forward full frames (reservation opcodes, schedule)
+                19/10/2026-- V1.4-- Publish charger availability as retained message
+                19/10/2026-- V1.5-- Per zone availability topic, shared last will topic
+                19/10/2026-- V1.6-- Replication topic and unique client name for the hot standby board
+                19/10/2026-- V1.7-- Drain UART per pass, publish in place from the frame buffer, bridge counters
+                19/10/2026-- V1.8-- Non blocking reconnect with backoff, store and forward during outages
+                19/10/2026-- V1.9-- Ordered broker list, health echo and failover
+                19/10/2026-- V1.10-- Acknowledged control frames with resend window, persistent session
+                19/10/2026-- V1.11-- Optional embedded broker for the zone nodes, control frame round trip counter
+                19/10/2026-- V1.12-- Time replies to the dashboard are not control frames
+                19/10/2026-- V1.13-- Replication goes through the upstream broker with the embedded broker
 
 ***/
 #include <ESP8266WiFi.h>  // Wifi Driver
@@ -15,30 +26,158 @@ Modifications : 17/01/2018-- V1.0-- Initial Creation, MQTT Test, UART TEST
 
 const char* ssid = "AIRTEL_GILL"; // Put Your SSID
 const char* password = "A!RTEL_G!LL"; // Put Your Password
-const char* mqtt_server = "192.168.0.101";  // Server Address
+const char* mqtt_servers[] = {"192.168.0.101", "192.168.0.102"};  // Broker addresses, in order of preference
+#define brokers (sizeof(mqtt_servers)/sizeof(mqtt_servers[0]))
 //#define debug 1
-#define node_id 5 // node id
+#define node_id 5 // node id, one coordinator per zone
 const char *myname="NODE5"; // node name for mqtt broker
 #define broadcast 255
+#define disp_id 10 // dashboard topic, the coordinator counters go to disp_id/node_id so they are not read as node telemetry
+#define avail_id 12 // charger availability topic, published retained as avail_id/node_id
+#define lost_id 13 // topic carrying the last will of node bridges
+#define repl_id 14 // replication topic between primary and standby, used as repl_id/node_id
+#define board 0 // 0 -> primary board, 1 -> hot standby board of the same coordinator ID
+#define health_id 17 // broker health echo topic, health_id/node_id, published and heard back by the bridge
+#define health_freq 2000 // ms between health echoes
+#define health_timeout 3000 // ms without the echo after which the bridge fails over to the next broker
+#define stats_id 16 // bridge counters topic, stats_id/node_id: id,frames,bytes,max latency(ms),dropped,last outage(ms),replayed,expired,broker,echo rtt(ms),control frames,resends,lost,duplicates,max resend latency(ms),max ack rtt(ms)
+#define stats_freq 10000 // ms between bridge counter reports
+#define ack_id 18 // control frame acks, ack_id/<bridge id>: seq
+#define time_id 19 // time exchange replies to the dashboard
+#define log_id 20 // telemetry replayed by the zone nodes after an outage
+#define bridge_id 0 // frames for the bridge itself, never published
+#define op_hold 15 // hold frame of the coordinator: 0,id,0,op,ms (0 -> release), its flash bus stalls while a journal sector is erased
+#define hold_depth 512 // bytes towards the coordinator kept while it holds
+#define op_role 16 // role frame of the coordinator: 0,id,active,op; only the bridge of the active board acks control frames
+#define window 4 // control frames awaiting their ack
+#define ack_timeout 400 // ms before an unacknowledged control frame is resent
+#define max_tries 4 // sends of a control frame before it is counted lost
+#define dedup_depth 16 // received control frames remembered for duplicate suppression
+#define embedded_broker 0 // 1 -> this bridge is the MQTT broker of its zone nodes, only telemetry and replication go to mqtt_servers
+#define broker_port 1883 // port of the embedded broker
+#define max_clients 8 // node bridges served by the embedded broker
+#define max_subs 20 // subscriptions per node bridge: health, ack, own ID, 11, 12/+, 15 and at most 12 broadcast/peer bands (18), PubSubClient ignores a failed SUBACK
+#define max_retained 8 // retained messages kept by the embedded broker
+#define backoff_min 500		// ms, first MQTT reconnect delay
+#define backoff_max 30000	// ms, longest MQTT reconnect delay (doubled per failure, plus jitter)
+#define uart_rx_buffer 4096	// bytes of UART frames buffered while a broker connect blocks the loop (4 s at 9600 baud)
+#define connect_timeout 1000	// ms a TCP connect to a broker may block
+#define mqtt_timeout 2		// s PubSubClient waits for the CONNACK, a LAN broker answers in milliseconds
+#define sf_depth 8			// frames held while the broker is unreachable
+#define sf_ttl 10000		// ms a held control frame stays worth sending
 WiFiClient espClient;		// Spawn Wifi Client 
 PubSubClient client(espClient); // Spawn MQTT Client
 long lastMsg = 0;				// Flag to send Ping Request
 char msg[50];					// local buffer to store uart messages from NODE
 int value = 0;					
 char *token;					// CSV parser buffer
-char buf3[30];					// local buffer to store ID(char)
+char buf3[100];					// local buffer to store received payload
 int ID,statt;					// local buffer to store ID(int),SOC(int)
-char buf[50];					// local buffer to store subscribe TOPIC
+char buf[100];					// local buffer to store publish payload
 int id,stat,destination;		// variable to store UART received ID(int), SOC(int), REMOTE ID(int)
 char temp_buf[100];				// local buffer
 int index1=0;					
 char buf2[20];					// buffer to store topic
+char client_name[20];			// MQTT client name, unique per board
+char topic_avail[10];			// precomputed availability topic
+char topic_repl[10];			// precomputed replication topic
+char topic_stats[10];			// precomputed bridge counters topic
+char topic_counters[10];		// precomputed coordinator counters topic
+bool overflow=false;			// frame longer than temp_buf, dropped up to its terminator
+unsigned long frame_start=0;	// arrival of the first byte of the current frame
+unsigned long stats_time=0;		// next bridge counter report
+unsigned long frames=0,bytes=0,max_latency=0,dropped=0;	// bridge counters of the current period
+unsigned long retry_time=0;		// next MQTT connection attempt
+unsigned long backoff=backoff_min;	// current reconnect delay
+unsigned long outage_start=0;	// broker lost, 0 while connected
+unsigned long outage=0;			// ms of the last broker outage
+unsigned long replayed=0,expired=0;	// held frames sent after reconnect / dropped (expired or evicted) in the period
+typedef struct {
+  char topic[20];				// destination topic
+  char payload[100];			// payload, not NUL terminated
+  int len;						// payload length
+  bool retained;				// publish retained
+  bool telemetry;				// latest value only, coalesced per topic and never expires
+  unsigned long expiry;			// control frames are dropped after this time
+} held_t;
+held_t held[sf_depth];			// store and forward queue, FIFO
+int held_head=0,held_count=0;	// oldest held frame, number of held frames
+int broker=0;					// index of the broker in use
+char topic_health[10];			// precomputed health echo topic
+unsigned long health_time=0;	// next health echo
+unsigned long ping_sent=0;		// time of the pending health echo, 0 -> none pending
+unsigned long echo_rtt=0;		// round trip of the last health echo
+char topic_own[8];				// precomputed own ID topic
+char topic_ack[10];				// precomputed ack topic of this bridge
+typedef struct {
+  char topic[20];				// destination topic
+  char payload[112];			// tagged frame, not NUL terminated
+  int len;						// tagged frame length
+  unsigned int seq;				// sequence number in the tag
+  unsigned long first;			// first send
+  unsigned long sent;			// last send
+  int tries;					// sends so far, 0 -> slot free
+} inflight_t;
+inflight_t inflight[window];	// control frames awaiting their ack
+unsigned int seq=0;				// last control frame sequence number
+unsigned int boot=0;			// random per boot, sequence numbers of an earlier boot never match
+int seen_src[dedup_depth];		// recently received control frames: sender bridge
+unsigned int seen_boot[dedup_depth];	// recently received control frames: boot of the sender
+unsigned int seen_seq[dedup_depth];	// recently received control frames: sequence number
+int seen_pos=0;					// next slot to overwrite
+char hold_buf[hold_depth];		// frames towards the coordinator while it holds
+int hold_len=0;					// bytes in hold_buf
+bool holding=false;				// coordinator asked us to hold its frames
+bool serving=(board==0);		// our board serves the ID (role frame), the standby bridge must not ack for it
+unsigned long hold_until=0;		// hold ends at the latest here, the coordinator may miss the release
+unsigned long ctl=0,retx=0,lost=0,dups=0,retx_latency=0,ack_rtt=0;	// control frame counters of the current period
+#if embedded_broker
+WiFiServer broker_server(broker_port);	// embedded broker, zone node bridges connect here
+typedef struct {
+  WiFiClient sock;				// connection of the node bridge
+  bool used;					// slot in use
+  char id[24];					// MQTT client id
+  char subs[max_subs][24];		// topic filters
+  int nsubs;					// number of topic filters
+  char will_topic[24];			// last will topic, empty -> none
+  char will_msg[40];			// last will payload
+  int will_len;					// last will payload length
+  bool will_retain;				// last will is retained
+  unsigned long keepalive;		// ms of silence after which the bridge is dropped, 1.5x its keepalive
+  unsigned long last_seen;		// last packet received
+  uint8_t rx[192];				// received bytes, not yet a full packet
+  int rx_len;					// bytes in rx
+} zone_client_t;
+zone_client_t zone[max_clients];	// node bridges of this zone
+typedef struct {
+  char topic[24];				// topic, empty -> slot free
+  uint8_t payload[48];			// last retained payload
+  int len;						// payload length
+} retained_t;
+retained_t retained_msgs[max_retained];	// retained messages (charger availability)
+#endif
 void setup() {
   pinMode(BUILTIN_LED, OUTPUT);     // Initialize the BUILTIN_LED pin as an output
+  Serial.setRxBufferSize(uart_rx_buffer);	// frames keep arriving while a connect attempt blocks
   Serial.begin(9600);				//intialize UART with 9600
   setup_wifi();						// wifi init
-  client.setServer(mqtt_server, 1883); // MQTT init
+  #if embedded_broker
+  broker_server.begin();			// zone nodes connect to this bridge
+  #endif
+  client.setServer(mqtt_servers[broker], 1883); // MQTT init
+  espClient.setTimeout(connect_timeout);	// bound the blocking part of each connect attempt
+  client.setSocketTimeout(mqtt_timeout);
   client.setCallback(callback);			// MQTT setcallback on message
+  sprintf(client_name,"%s_%d",myname,board); // both boards of one ID must not kick each other off the broker
+  sprintf(topic_avail,"%d/%d",avail_id,node_id); // one availability/replication topic per zone coordinator
+  sprintf(topic_repl,"%d/%d",repl_id,node_id);
+  sprintf(topic_stats,"%d/%d",stats_id,node_id);
+  sprintf(topic_counters,"%d/%d",disp_id,node_id);
+  sprintf(topic_health,"%d/%d",health_id,node_id);
+  sprintf(topic_own,"%d",node_id);
+  sprintf(topic_ack,"%d/%d",ack_id,node_id);
+  randomSeed(ESP.random());				// hardware RNG, bridges must not share backoff jitter
+  boot=ESP.random()&0xFFFF;
 }
 
 void setup_wifi() {
@@ -75,10 +214,23 @@ void callback(char* topic, byte* payload, unsigned int length) {
   }
   Serial.println();
   #endif
+if(strcmp(topic,topic_health)==0){ // health echo, broker alive
+  echo_rtt=millis()-ping_sent;
+  ping_sent=0;
+  return;
+}
+if(strcmp(topic,topic_ack)==0){ // ack of one of our control frames
+  ack_received(payload,length);
+  return;
+}
+if(strcmp(topic,topic_own)==0 && (length=strip_control(payload,length))==0)
+  return; // duplicate control frame
+if(length>=sizeof(buf3)) length=sizeof(buf3)-1; // clip oversized payloads
 for(int i=0;i<length;i++)
   {
     buf3[i]=(char)payload[i]; // convert byte array to char array
   }
+buf3[length]='\0';
 // parse CSV message into ID and stat
 token = strtok(buf3, ",");
 ID=atoi(token);
@@ -90,72 +242,706 @@ Serial.println(ID);
 Serial.print("Status=");
 Serial.println(statt);
 #endif
-for (int i = 0; i < length; i++) {
-    Serial.print((char)payload[i]);
-  }
-
+to_coordinator(payload,length);
 }
 
 void reconnect() {
-  // Loop until we're reconnected
-  while (!client.connected()) {
+  // one attempt per backoff period, the UART keeps being drained meanwhile
+  if (outage_start==0)
+    outage_start=millis();
+  if ((long)(millis()-retry_time)<0)
+    return;
+  #ifdef debug
+  Serial.print("Attempting MQTT connection...");
+  #endif
+  if (client.connect(client_name, NULL, NULL, NULL, 0, false, NULL, true)) { // clean session, every subscription is made again below
+    #ifdef debug
+    Serial.println("COnnected Now");
+    #endif
+    outage=millis()-outage_start;
+    outage_start=0;
+    backoff=backoff_min;
+    ping_sent=0;
+    client.subscribe(topic_health);
+    #if !embedded_broker // the zone topics are otherwise served by the embedded broker
+    client.subscribe(topic_ack,1);
+    char buf_temp_sub[10];
+    client.subscribe(topic_own,1); // control frames at QoS 1
+    String(lost_id).toCharArray(buf_temp_sub,10); // last will of node bridges
+    client.subscribe(buf_temp_sub);
+    sprintf(buf_temp_sub,"%d/%d",repl_id,node_id); // replication between the boards of this ID
+    client.subscribe(buf_temp_sub);
+    #else
+    client.subscribe(topic_own); // time requests of the dashboard, the zone nodes reach us through the embedded broker
+    client.subscribe(topic_repl); // the other board of this ID is behind its own embedded broker
+    #endif
+  } else {
     #ifdef debug
-    Serial.print("Attempting MQTT connection...");
+    Serial.print("failed, rc=");
+    Serial.print(client.state());
+    Serial.println(" try again later");
     #endif
-    if (client.connect(myname)) {
-      #ifdef debug
-      Serial.println("COnnected Now");
-      #endif
-      char buf_temp_sub[10];
-      String(node_id).toCharArray(buf_temp_sub,10);
-      client.subscribe(buf_temp_sub);
-    } else {
-      #ifdef debug
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" try again in 5 seconds");
-      #endif
-      delay(5000);
+    broker=(broker+1)%brokers; // try the next broker right away
+    client.setServer(mqtt_servers[broker], 1883);
+    if(broker==0){ // whole list failed, back off
+      retry_time=millis()+backoff+random(backoff/2); // jitter, bridges must not reconnect in lock step
+      backoff=min(backoff*2,(unsigned long)backoff_max);
     }
   }
 }
 
 void loop(){
+  #if embedded_broker
+  broker_loop(); // zone traffic does not depend on the upstream broker
+  retransmit();
+  #endif
   if (!client.connected()) {
     reconnect();
   }
-  client.loop();
-  if(Serial.available())
+  else {
+    if(held_count>0)
+      replay();
+    client.loop();
+    #if !embedded_broker
+    retransmit();
+    #endif
+    if(ping_sent!=0 && millis()-ping_sent>health_timeout){ // broker stopped answering, fail over
+      client.disconnect();
+      broker=(broker+1)%brokers;
+      client.setServer(mqtt_servers[broker], 1883);
+      retry_time=millis();
+      ping_sent=0;
+    }
+    else if(ping_sent==0 && (long)(millis()-health_time)>=0){
+      health_time=millis()+health_freq;
+      ping_sent=millis();
+      client.publish(topic_health,"1");
+    }
+  }
+  if(holding && (long)(millis()-hold_until)>=0)
+    release_hold();
+  while(Serial.available()) // drain everything the coordinator sent since the last pass
     {
       char c=Serial.read();
+      if(index1==0)
+        frame_start=millis();
+      if(overflow || index1>=sizeof(temp_buf)-1)
+        {
+          overflow=(c!='#'); // oversized frame, skip to its terminator
+          index1=0;
+          if(!overflow)
+            dropped++;
+          continue;
+        }
+      temp_buf[index1++]=c;
       if(c=='#')
         {
 		// if uart message reception done  
-        index1=0;// set index as 0
-        token = strtok(temp_buf, ","); //parse CSV received from UART
-        destination = atoi(token);
-        token = strtok(NULL, ",");
-        id = atoi(token);
-        token = strtok(NULL, ",");
-        stat = atoi(token);
-        sprintf(buf,"%d,%d#",id,stat); // prepare payload
-        sprintf(buf2,"%d",destination); // prepare topic
-        client.publish(buf2,buf); // publish message to remote NODE
-        #ifdef debug // display for fun :)
-        Serial.print("id=");
-        Serial.println(id);
-        Serial.print("stat=");
-        Serial.println(stat);
-        Serial.print("destination=");
-        Serial.println(destination);
-        #endif
-        //do your thing
+          temp_buf[index1]='\0';
+          forward_frame();
+          index1=0;// set index as 0
         }
-      else{
-        temp_buf[index1]=c;
-        temp_buf[index1+1]='\0';
-        index1+=1;
+    }
+  if(client.connected() && (long)(millis()-stats_time)>=0) // bridge throughput, forwarding latency, outage
+    {
+      stats_time=millis()+stats_freq;
+      sprintf(buf,"%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu#",node_id,frames,bytes,max_latency,dropped,outage,replayed,expired,broker,echo_rtt,ctl,retx,lost,dups,retx_latency,ack_rtt);
+      client.publish(topic_stats,buf);
+      frames=0;
+      bytes=0;
+      max_latency=0;
+      dropped=0;
+      replayed=0;
+      expired=0;
+      ctl=0;
+      retx=0;
+      lost=0;
+      dups=0;
+      retx_latency=0;
+      ack_rtt=0;
+    }
+}
+/*
+  publishes the frame in temp_buf straight from the buffer: "dest,id,stat[,op,args]#" goes to topic
+  dest (terminated in place, availability/replication/counters to their per zone topic) with the rest as payload.
+*/
+void forward_frame(){
+  char *topic,*payload;
+  int len;
+  payload=strchr(temp_buf, ','); // rest of the frame (id,stat[,op,args]#) is the payload
+  if(payload==NULL)
+    return;
+  *payload++='\0';
+  len=index1-(payload-temp_buf);
+  destination = atoi(temp_buf); // first CSV field is the destination topic
+  if(destination==bridge_id){
+    int op=0;
+    unsigned long ms=0;
+    sscanf(payload, "%d,%d,%d,%lu", &id, &stat, &op, &ms);
+    if(op==op_role)
+      serving=stat;
+    else if(op==op_hold && ms>0){
+      holding=true;
+      hold_until=millis()+ms;
+    }
+    else if(op==op_hold)
+      release_hold();
+    return;
+  }
+  if(destination==avail_id)
+    topic=topic_avail;
+  else if(destination==repl_id)
+    topic=topic_repl;
+  else if(destination==disp_id)
+    topic=topic_counters;
+  else
+    topic=temp_buf;
+  send_frame(topic,payload,len,destination==avail_id,destination==avail_id || destination==disp_id); // availability is retained, state/counters coalesced while offline
+  if(millis()-frame_start>max_latency)
+    max_latency=millis()-frame_start;
+  #ifdef debug // display for fun :)
+  sscanf(payload, "%d,%d", &id, &stat);
+  Serial.print("id=");
+  Serial.println(id);
+  Serial.print("stat=");
+  Serial.println(stat);
+  Serial.print("destination=");
+  Serial.println(destination);
+  #endif
+}
+/*
+  writes a frame to the coordinator, kept in hold_buf while it holds (dropped if that is full).
+*/
+void to_coordinator(const byte* payload, unsigned int length){
+  if(!holding){
+    Serial.write(payload,length);
+    return;
+  }
+  if(hold_len+length>sizeof(hold_buf)){
+    dropped++;
+    return;
+  }
+  memcpy(hold_buf+hold_len,payload,length);
+  hold_len+=length;
+}
+/*
+  ends a hold, the kept frames go out in arrival order.
+*/
+void release_hold(){
+  holding=false;
+  Serial.write((const uint8_t*)hold_buf,hold_len);
+  hold_len=0;
+}
+/*
+  publishes a frame, or holds it while the broker is unreachable: telemetry keeps only its latest
+  value per topic, control frames are kept until sf_ttl and the oldest frame is evicted when full.
+*/
+void send_frame(const char *topic, const char *payload, int len, bool retained, bool telemetry){
+  if(deliverable(topic)){
+    publish_frame(topic,payload,len,retained);
+    frames++;
+    bytes+=len;
+    return;
+  }
+  if(len>sizeof(held[0].payload) || strlen(topic)>=sizeof(held[0].topic)){
+    expired++;
+    return;
+  }
+  int slot=-1;
+  for(int k=0;k<held_count && telemetry;k++){
+    int i=(held_head+k)%sf_depth;
+    if(held[i].telemetry && strcmp(held[i].topic,topic)==0)
+      slot=i; // coalesce, the newer value replaces the held one
+  }
+  if(slot<0){
+    if(held_count==sf_depth){ // evict the oldest frame
+      held_head=(held_head+1)%sf_depth;
+      held_count--;
+      expired++;
+    }
+    slot=(held_head+held_count)%sf_depth;
+    held_count++;
+  }
+  strcpy(held[slot].topic,topic);
+  memcpy(held[slot].payload,payload,len);
+  held[slot].len=len;
+  held[slot].retained=retained;
+  held[slot].telemetry=telemetry;
+  held[slot].expiry=millis()+sf_ttl;
+}
+/*
+  sends the frames held during the outage in arrival order, expired control frames are dropped. Stops
+  while the in-flight window is full, the rest follows as acks free slots.
+*/
+void replay(){
+  while(held_count>0 && client.connected()){
+    held_t *f=&held[held_head];
+    if(is_control(f->topic) && window_full())
+      return;
+    held_head=(held_head+1)%sf_depth;
+    held_count--;
+    if(!f->telemetry && (long)(millis()-f->expiry)>0){
+      expired++;
+      continue;
+    }
+    publish_frame(f->topic,f->payload,f->len,f->retained);
+    replayed++;
+  }
+}
+/*
+  control frames (unicast to a node or coordinator) go out with "~<bridge id>/<boot>/<seq>" behind the frame and
+  are acknowledged by the receiving bridge on ack_id/<bridge id>. Unacknowledged ones are resent from the
+  in-flight window, duplicates are dropped on receipt, telemetry and topic broadcasts stay fire and forget.
+*/
+bool is_control(const char *topic){
+  int d=atoi(topic);
+  return strchr(topic,'/')==NULL && d!=0 && d!=255 && (d<disp_id || d>log_id);
+}
+void publish_frame(const char *topic, const char *payload, int len, bool retained){
+  if(is_control(topic) && len+20<=sizeof(inflight[0].payload) && strlen(topic)<sizeof(inflight[0].topic)){
+    int slot=0;
+    for(int i=0;i<window;i++){ // free slot, else the oldest frame gives up
+      if(inflight[i].tries==0){
+        slot=i;
+        break;
       }
+      if(inflight[i].first<inflight[slot].first)
+        slot=i;
     }
-  
+    inflight_t *f=&inflight[slot];
+    if(f->tries!=0)
+      lost++;
+    memcpy(f->payload,payload,len);
+    f->seq=++seq;
+    f->len=len+sprintf(f->payload+len,"~%d/%u/%u",node_id,boot,f->seq);
+    strcpy(f->topic,topic);
+    f->first=millis();
+    f->sent=f->first;
+    f->tries=1;
+    ctl++;
+    topic=f->topic;
+    payload=f->payload;
+    len=f->len;
+  }
+  mqtt_publish(topic,payload,len,retained);
+}
+/*
+  true if every in-flight slot waits for its ack, a new control frame would push one out as lost.
+*/
+bool window_full(){
+  for(int i=0;i<window;i++)
+    if(inflight[i].tries==0)
+      return false;
+  return true;
+}
+/*
+  resends control frames whose ack is overdue, gives up after max_tries sends.
+*/
+void retransmit(){
+  for(int i=0;i<window;i++){
+    inflight_t *f=&inflight[i];
+    if(f->tries==0 || millis()-f->sent<ack_timeout)
+      continue;
+    if(f->tries>=max_tries){
+      f->tries=0;
+      lost++;
+      continue;
+    }
+    f->tries++;
+    f->sent=millis();
+    retx++;
+    mqtt_publish(f->topic,f->payload,f->len,false);
+  }
+}
+/*
+  ack of one of our control frames, frees its in-flight slot.
+*/
+void ack_received(byte* payload, unsigned int length){
+  char tag[8];
+  if(length>=sizeof(tag)) length=sizeof(tag)-1;
+  memcpy(tag,payload,length);
+  tag[length]='\0';
+  unsigned int s=atoi(tag);
+  for(int i=0;i<window;i++){
+    if(inflight[i].tries!=0 && inflight[i].seq==s){
+      if(inflight[i].tries>1 && millis()-inflight[i].first>retx_latency)
+        retx_latency=millis()-inflight[i].first; // delivered by a resend
+      if(inflight[i].tries==1 && millis()-inflight[i].first>ack_rtt)
+        ack_rtt=millis()-inflight[i].first; // negotiation round trip through the broker(s)
+      inflight[i].tries=0;
+    }
+  }
+}
+/*
+  acknowledges a received control frame (only while our board is the active one, an ack must mean the
+  serving coordinator got it) and strips its tag, returns the frame length, 0 for a duplicate.
+*/
+unsigned int strip_control(byte* payload, unsigned int length){
+  unsigned int pos=0;
+  char tag[24],ack[8],ack_topic[10];
+  while(pos<length && payload[pos]!='~')
+    pos++;
+  if(pos==length || length-pos>=sizeof(tag))
+    return pos; // untagged frame
+  memcpy(tag,payload+pos+1,length-pos-1);
+  tag[length-pos-1]='\0';
+  char *slash=strchr(tag,'/');
+  char *slash2=(slash!=NULL) ? strchr(slash+1,'/') : NULL;
+  if(slash2==NULL)
+    return pos;
+  int src=atoi(tag);
+  unsigned int b=atoi(slash+1);
+  unsigned int s=atoi(slash2+1);
+  sprintf(ack_topic,"%d/%d",ack_id,src);
+  sprintf(ack,"%u",s);
+  if(serving)
+    mqtt_publish(ack_topic,ack,strlen(ack),false);
+  for(int i=0;i<dedup_depth;i++){
+    if(seen_src[i]==src && seen_boot[i]==b && seen_seq[i]==s){
+      dups++;
+      return 0; // resend of a frame already forwarded, its ack was lost
+    }
+  }
+  seen_src[seen_pos]=src;
+  seen_boot[seen_pos]=b;
+  seen_seq[seen_pos]=s;
+  seen_pos=(seen_pos+1)%dedup_depth;
+  return pos;
+}
+/*
+  topics that leave the zone when the embedded broker is used: dashboard frames, bridge counters, time
+  replies to the dashboard, replayed node telemetry and replication. Each board of a hot standby pair
+  runs its own embedded broker, so the replication topic has to meet on the upstream broker; the
+  dashboard's time requests and the other board's replication come down on the own ID and replication
+  topics (subscribed upstream in reconnect()).
+*/
+bool is_upstream(const char *topic){
+  int d=atoi(topic);
+  return d==disp_id || d==stats_id || d==time_id || d==log_id || d==repl_id;
+}
+/*
+  true if a frame for topic can be published right now, zone topics are always served by the embedded broker.
+*/
+bool deliverable(const char *topic){
+  #if embedded_broker
+  if(!is_upstream(topic))
+    return true;
+  #endif
+  return client.connected();
 }
+/*
+  publishes a frame of this bridge, to the zone nodes and/or the upstream broker.
+*/
+void mqtt_publish(const char *topic, const char *payload, int len, bool retained){
+  #if embedded_broker
+  broker_route(topic,(const uint8_t*)payload,len,retained,false);
+  if(!is_upstream(topic))
+    return;
+  #endif
+  client.beginPublish(topic,len,retained); // streamed to the broker, no intermediate copy
+  client.write((const uint8_t*)payload,len);
+  client.endPublish();
+}
+#if embedded_broker
+/*
+  minimal MQTT 3.1.1 broker for the node bridges of this zone: CONNECT with last will, PUBLISH at QoS 0/1
+  (delivered at QoS 0, control frames carry their own acks), SUBSCRIBE with '+'/'#' filters, retained
+  messages, PINGREQ and keepalive. Sessions are not persisted, the node bridges subscribe on every connect.
+*/
+void broker_loop(){
+  WiFiClient c=broker_server.available();
+  if(c){
+    int i=0;
+    while(i<max_clients && zone[i].used)
+      i++;
+    if(i==max_clients)
+      c.stop(); // zone full
+    else{
+      zone_client_t *z=&zone[i];
+      z->sock=c;
+      z->sock.setNoDelay(true); // frames are small, do not wait for more
+      z->used=true;
+      z->id[0]='\0';
+      z->nsubs=0;
+      z->will_topic[0]='\0';
+      z->keepalive=5000; // CONNECT expected within 5 s
+      z->last_seen=millis();
+      z->rx_len=0;
+    }
+  }
+  for(int i=0;i<max_clients;i++){
+    if(!zone[i].used)
+      continue;
+    if(!zone[i].sock.connected())
+      broker_drop(i);
+    else if(zone[i].sock.available()){
+      zone[i].last_seen=millis();
+      broker_read(i);
+    }
+    else if(zone[i].keepalive!=0 && millis()-zone[i].last_seen>zone[i].keepalive)
+      broker_drop(i); // silent node bridge, its last will goes out
+  }
+}
+/*
+  closes the connection of a node bridge and publishes its last will, if any.
+*/
+void broker_drop(int c){
+  zone_client_t *z=&zone[c];
+  z->sock.stop();
+  z->used=false;
+  if(z->will_topic[0]!='\0')
+    broker_route(z->will_topic,(const uint8_t*)z->will_msg,z->will_len,z->will_retain,true);
+}
+/*
+  reads the bytes of a node bridge and handles every complete packet.
+*/
+void broker_read(int c){
+  zone_client_t *z=&zone[c];
+  while(z->sock.available() && z->rx_len<sizeof(z->rx))
+    z->rx[z->rx_len++]=z->sock.read();
+  while(z->used && z->rx_len>=2){
+    int rem=0,n=1;
+    uint8_t b;
+    do{ // remaining length, 7 bits per byte
+      if(n>=z->rx_len)
+        return;
+      b=z->rx[n];
+      rem|=(b&0x7F)<<(7*(n-1));
+      n++;
+    }while((b&0x80) && n<5);
+    if(n+rem>sizeof(z->rx)){
+      broker_drop(c); // larger than any frame of this network
+      return;
+    }
+    if(z->rx_len<n+rem)
+      return;
+    broker_packet(c,z->rx[0],z->rx+n,rem);
+    z->rx_len-=n+rem;
+    memmove(z->rx,z->rx+n+rem,z->rx_len);
+  }
+}
+/*
+  reads a length prefixed MQTT string at pos into out (skipped if out is NULL), returns the next position, -1 if malformed.
+*/
+int read_string(const uint8_t *p, int len, int pos, char *out, int size){
+  if(pos+2>len)
+    return -1;
+  int n=(p[pos]<<8)|p[pos+1];
+  pos+=2;
+  if(pos+n>len || (out!=NULL && n>=size))
+    return -1;
+  if(out!=NULL){
+    memcpy(out,p+pos,n);
+    out[n]='\0';
+  }
+  return pos+n;
+}
+/*
+  handles one packet of a node bridge.
+*/
+void broker_packet(int c, uint8_t head, const uint8_t *p, int len){
+  zone_client_t *z=&zone[c];
+  char topic[24];
+  int pos;
+  switch(head>>4){
+    case 1:{ // CONNECT
+      pos=read_string(p,len,0,NULL,0); // protocol name
+      if(pos<0 || pos+4>len){
+        broker_drop(c);
+        return;
+      }
+      uint8_t flags=p[pos+1];
+      z->keepalive=((p[pos+2]<<8)|p[pos+3])*1500UL;
+      pos=read_string(p,len,pos+4,topic,sizeof(topic)); // client id
+      if(pos>=0 && (flags&0x04)){ // last will
+        pos=read_string(p,len,pos,z->will_topic,sizeof(z->will_topic));
+        int start=pos;
+        if(pos>=0)
+          pos=read_string(p,len,pos,z->will_msg,sizeof(z->will_msg));
+        z->will_len=pos-start-2;
+        z->will_retain=(flags&0x20)!=0;
+      }
+      if(pos<0){
+        z->will_topic[0]='\0';
+        broker_drop(c);
+        return;
+      }
+      for(int i=0;i<max_clients;i++)
+        if(i!=c && zone[i].used && strcmp(zone[i].id,topic)==0)
+          broker_drop(i); // reconnect of a bridge whose old connection is not closed yet
+      strcpy(z->id,topic);
+      uint8_t connack[4]={0x20,2,0,0};
+      z->sock.write(connack,4);
+      break;
+    }
+    case 3:{ // PUBLISH
+      pos=read_string(p,len,0,topic,sizeof(topic));
+      int qos=(head>>1)&3;
+      if(pos<0 || qos==2 || (qos==1 && pos+2>len)){
+        broker_drop(c);
+        return;
+      }
+      if(qos==1){
+        uint8_t puback[4]={0x40,2,p[pos],p[pos+1]};
+        z->sock.write(puback,4);
+        pos+=2;
+      }
+      broker_route(topic,p+pos,len-pos,head&1,true);
+      break;
+    }
+    case 8:{ // SUBSCRIBE
+      uint8_t suback[4+max_subs];
+      int n=4,first=z->nsubs;
+      pos=2;
+      while(pos>=0 && pos<len && n<sizeof(suback)){
+        pos=read_string(p,len,pos,topic,sizeof(topic));
+        if(pos<0 || pos>=len)
+          break;
+        pos++; // requested QoS, granted 0
+        suback[n++]=broker_subscribe(c,topic)?0:0x80;
+      }
+      if(len<2 || n==4){
+        broker_drop(c);
+        return;
+      }
+      suback[0]=0x90;
+      suback[1]=n-2;
+      suback[2]=p[0];
+      suback[3]=p[1];
+      z->sock.write(suback,n);
+      for(int r=0;r<max_retained;r++) // retained messages of the new filters
+        for(int k=first;k<z->nsubs && retained_msgs[r].topic[0]!='\0';k++)
+          if(topic_match(z->subs[k],retained_msgs[r].topic)){
+            broker_send(c,retained_msgs[r].topic,retained_msgs[r].payload,retained_msgs[r].len,true);
+            break;
+          }
+      break;
+    }
+    case 10:{ // UNSUBSCRIBE
+      pos=2;
+      while(pos>=0 && pos<len){
+        pos=read_string(p,len,pos,topic,sizeof(topic));
+        for(int k=0;pos>=0 && k<z->nsubs;k++)
+          if(strcmp(z->subs[k],topic)==0){
+            z->nsubs--;
+            memmove(z->subs[k],z->subs[z->nsubs],sizeof(z->subs[0])); // last filter takes its place
+            break;
+          }
+      }
+      if(len<2){
+        broker_drop(c);
+        return;
+      }
+      uint8_t unsuback[4]={0xB0,2,p[0],p[1]};
+      z->sock.write(unsuback,4);
+      break;
+    }
+    case 12:{ // PINGREQ
+      uint8_t pingresp[2]={0xD0,0};
+      z->sock.write(pingresp,2);
+      break;
+    }
+    case 14: // DISCONNECT, no last will
+      z->will_topic[0]='\0';
+      broker_drop(c);
+      break;
+  }
+}
+/*
+  adds a topic filter of a node bridge, false if it has no room left.
+*/
+bool broker_subscribe(int c, const char *filter){
+  zone_client_t *z=&zone[c];
+  for(int k=0;k<z->nsubs;k++)
+    if(strcmp(z->subs[k],filter)==0)
+      return true;
+  if(z->nsubs==max_subs)
+    return false;
+  strcpy(z->subs[z->nsubs++],filter);
+  return true;
+}
+/*
+  MQTT topic filter match, '+' is one level and '#' the rest of the topic.
+*/
+bool topic_match(const char *filter, const char *topic){
+  while(*filter){
+    if(*filter=='#')
+      return true;
+    if(*filter=='+'){
+      while(*topic && *topic!='/')
+        topic++;
+      filter++;
+    }
+    else if(*filter++!=*topic++)
+      return false;
+  }
+  return *topic=='\0';
+}
+/*
+  delivers a PUBLISH at QoS 0 to one node bridge.
+*/
+void broker_send(int c, const char *topic, const uint8_t *payload, int len, bool retain){
+  uint8_t head[8+24];
+  int tlen=strlen(topic),rem=2+tlen+len,n=0;
+  head[n++]=0x30|(retain?1:0);
+  do{
+    uint8_t b=rem&0x7F;
+    rem>>=7;
+    head[n++]=b|(rem>0?0x80:0);
+  }while(rem>0);
+  head[n++]=tlen>>8;
+  head[n++]=tlen&0xFF;
+  memcpy(head+n,topic,tlen);
+  n+=tlen;
+  zone[c].sock.write(head,n);
+  zone[c].sock.write(payload,len);
+}
+/*
+  routes a frame published in the zone: retained store, matching node bridges, this bridge's own
+  topics, and upstream for telemetry of the node bridges (dropped while the upstream broker is away,
+  the next report replaces it).
+*/
+void broker_route(const char *topic, const uint8_t *payload, int len, bool retain, bool from_zone){
+  if(retain)
+    broker_retain(topic,payload,len);
+  for(int c=0;c<max_clients;c++){
+    if(!zone[c].used)
+      continue;
+    for(int k=0;k<zone[c].nsubs;k++)
+      if(topic_match(zone[c].subs[k],topic)){
+        broker_send(c,topic,payload,len,false);
+        break;
+      }
+  }
+  if(!from_zone)
+    return;
+  if(strcmp(topic,topic_own)==0 || strcmp(topic,topic_ack)==0 || strcmp(topic,topic_repl)==0
+      || (atoi(topic)==lost_id && strchr(topic,'/')==NULL))
+    callback((char*)topic,(byte*)payload,len); // topics this bridge subscribes to in central mode
+  else if(is_upstream(topic) && client.connected())
+    client.publish(topic,payload,len,retain);
+}
+/*
+  keeps the latest retained payload per topic, an empty payload clears it.
+*/
+void broker_retain(const char *topic, const uint8_t *payload, int len){
+  int slot=-1;
+  for(int r=0;r<max_retained;r++){
+    if(strcmp(retained_msgs[r].topic,topic)==0){
+      slot=r;
+      break;
+    }
+    if(slot<0 && retained_msgs[r].topic[0]=='\0')
+      slot=r;
+  }
+  if(slot<0 || len>sizeof(retained_msgs[0].payload) || strlen(topic)>=sizeof(retained_msgs[0].topic))
+    return; // store full, new subscribers wait for the next update
+  if(len==0){
+    retained_msgs[slot].topic[0]='\0';
+    return;
+  }
+  strcpy(retained_msgs[slot].topic,topic);
+  memcpy(retained_msgs[slot].payload,payload,len);
+  retained_msgs[slot].len=len;
+}
+#endif
@@ -19,45 +19,147 @@ Modifications : 25/02/2019-- Initial Creation --Basic test of Thread,LED,Buzzer,
                 18/03/2019-- V1.6.1-- Overall Integration test with 3 Nodes,thread synchronization, latency error removal by adding nonblocking loop
                 19/03/2019-- V1.6.2-- Overall Integration test with 3 Nodes, integration with coordinator
                 21/03/2019-- V1.7-- Final version
+                19/10/2026-- V1.8-- Charging slot reservation with the coordinator
+                19/10/2026-- V1.9-- Depletion forecasting, early charge request, coordinator invitations
+                19/10/2026-- V1.10-- Honour coordinator busy/retry-after replies
+                19/10/2026-- V1.11-- Renew charger lease with the dashboard telemetry
+                19/10/2026-- V1.12-- Negotiate only when the advertised charger state makes it worthwhile
+                19/10/2026-- V1.13-- Zone coordinators, load balanced coordinator selection
+                19/10/2026-- V1.14-- Build time selectable token passing arbitration
+                19/10/2026-- V1.15-- Peer SOC table, local arbitration without a broadcast round
+                19/10/2026-- V1.16-- Jittered objections on the broadcast topic, suppressed by lower SOC objections
+                19/10/2026-- V1.17-- Objection window sized from measured RTT, closed early by a decisive objection
+                19/10/2026-- V1.18-- Broadcasts and objections on SOC band topics
+                19/10/2026-- V1.19-- 16 bit node ids, hashed peer table
+                19/10/2026-- V1.20-- Push SOC changes to the bridge, which answers objections
+                19/10/2026-- V1.21-- Network time from the master coordinator, timestamped dashboard telemetry
+                19/10/2026-- V1.22-- Flash telemetry log while the bridge is offline, paced replay on reconnect
+                19/10/2026-- V1.23-- Send on delta dashboard telemetry, keepalive frame while idle
+                19/10/2026-- V1.24-- Sensor samples handed to the network thread through a seqlock snapshot, atomic flags
+                19/10/2026-- V1.25-- Needy nodes publish their SOC on banded peer topics, peer table trusted after an unbroken link
 
 ***/
 #include "mbed.h"
 #include <iostream> 
 #include <string> 
 #include "rtos.h"
+#include "../Argon_Common/NodeTable.h"
+#include "hal/trng_api.h"
 
 //------------------------------------------Global Variables Start Here-------------------------------
 
 //****************************************Network Specific*******************************************//
 
-uint8_t ID = 1; // Change ID for different Nodes
-uint8_t coordinator_id = 5; // Coordinator ID in the network
+uint16_t ID = 1; // Change ID for different Nodes (16 bit, must not clash with coordinator ids or topics 10-21, 255)
+#define home_coordinator 5 // Coordinator of this node's zone
+uint16_t coordinator_id = home_coordinator; // Coordinator currently negotiated with
 #define disp_id 10 // network dashboard ID
-#define dash_freq 10000 //Dashboard Message sending frequency
+#define dash_freq 10000 // keepalive frame and charger lease renewal period
+#define dash_min 1000 // ms, shortest gap between two full dashboard frames
+#define dash_max 60000 // ms, longest gap between two full dashboard frames while nothing changes
+#define soc_deadband 1 // SOC change (points) that makes a full dashboard frame due
+#define current_deadband 20 // battery current change (0.1A) that makes a full dashboard frame due
+#define temp_deadband 2 // motor temperature change (C) that makes a full dashboard frame due
+#define sched_id 11 // coordinator reservation schedule topic
+#define op_request 0 // charge request/ack (legacy frame without opcode)
+#define op_reserve 1 // reservation request/ack: id,stat,op,start(s from now),duration(s)
+#define op_schedule 3 // coordinator schedule: id,0,op,count,(node,start(s),duration(s))*count
+#define op_forecast 4 // depletion forecast: id,soc,op,seconds to nominal threshold
+#define op_invite 5 // coordinator invitation to charge ahead of the threshold
+#define op_busy 6 // coordinator shed the request: id,0,op,retry after(ms)
+#define op_renew 7 // charger lease renewal while charging
+#define op_decline 23 // grant turned down, the node already charges at another zone: id,soc,op
+#define avail_id 12 // retained coordinator availability topic (avail_id/<coordinator id>)
+#define max_Coordinators 8 // coordinators (zones) tracked from their adverts
+#define zone_saturation 2 // home queue length at which other zones are considered
+#define avail_stale 60000 // ms after which a coordinator advert is not trusted
+#define arbitration_token 0 // 1 -> token passing arbitration, 0 -> broadcast and objections
+#define token_id 15 // ring topic carrying the token holder refresh, and joins/leaves while no holder is known
+#define op_join 14 // ring join/refresh: id,soc,op,token held,token sequence; members send it to the holder's topic
+#define op_leave 15 // ring leave once charging: id,soc,op, to the holder's topic
+#define op_token 16 // token handed to the destination: id,soc,op,token sequence
+#define max_Members 16 // ring members tracked
+#define member_refresh 20000 // ms between join refreshes of a member
+#define member_ttl 60000 // ms after which a silent member is dropped
+#define token_hb 4000 // ms between refreshes of the token holder
+#define token_timeout 10000 // ms without token activity before the token is regenerated (scaled by SOC rank)
+#define token_retry 3000 // ms between charge requests of the token holder
+#define op_peer 17 // peer SOC frame on the peer topic: id,soc,op,charging
+#define peer_id 21 // needy peer SOC topic, peer_id/<SOC/band_width>; published at or below nominal_soc, heard by bridges at or above the band
+#define peer_refresh 10000 // ms between peer SOC frames of an unchanged node, well inside peer_stale
+#define max_Peers 256 // peers tracked in the SOC table, needy peers of a 200 node fleet at load below 0.8
+#define peer_stale 30000 // ms after which a peer entry is not trusted
+#define peer_retry 7000 // ms between charge requests decided from the peer table
+#define op_object 18 // objection on the broadcast topic: id,soc,op,objected node
+#define objection_slot 30 // ms of objection delay per SOC point at the bridge, the lowest SOC replies first
+#define objection_jitter 200 // ms of random objection delay at the bridge, both size the objection window
+#define bridge_id 0 // frames for the ESP bridge itself, never published
+#define op_soc 19 // SOC push to the bridge: id,soc,op; the bridge answers objections from it
+#define band_width 10 // SOC points per broadcast band topic, 255/<SOC/band_width>; bridges hear bands at or above their SOC
+#define rtt_samples 16 // coordinator round trips kept for the percentile
+#define rtt_percentile 90 // percentile of the round trip added to the objection window
+#define rtt_default 500 // ms round trip assumed before the first sample
+#define window_max 5000 // ms, longest objection window (the former fixed window)
+#define round_gap 2000 // ms between the close of a window and the next broadcast round
+#define op_avail 9 // availability: id,charging,op,queue length,lowest queued SOC
+#define time_master 5 // coordinator whose clock is the network timebase
+#define op_time 20 // time exchange: request id,soc,op,t1; reply id,0,op,t1,t2,t3 (ms, t2/t3 on the master clock)
+#define time_freq 30000 // ms between time requests once synced
+#define time_burst 2000 // ms between time requests until the first estimate
+#define time_samples 4 // exchanges kept, the one with the lowest round trip is used
+#define drift_baseline 600000 // ms between the two estimates a drift update is taken from
+#define drift_bound 50 // ppm of residual drift assumed when growing the error bound between exchanges
+#define time_unsynced 0xFFFF // error bound sent before the first estimate
+#define log_id 20 // replayed telemetry topic: id,soc,op,network time,error bound,current,temperature,charging
+#define op_log 21 // sample logged while the bridge was offline
+#define op_link 22 // bridge link state towards the node: 0,connected,op (on change and every 10 s)
+#define link_timeout 30000 // ms without a link frame after which the bridge is taken as offline
+#define log_rate 250 // ms between replayed samples, live frames keep their share of the UART
+#define log_base 0x08080000 // flash sector 8 (128KB), first of the telemetry log sectors
+#define log_sectors 4 // sectors 8-11 used in turn, each erased once per pass over the ring
+#define log_magic 0xA55C // marks a written telemetry log record
+#define log_head 0xFF // sector header record, time carries the sector sequence
+#define reserve_after 0 // seconds from now to book the shift charging slot, 0 -> reservation disabled
+#define reserve_len 1800 // reserved slot length in seconds
+#define reserve_retry 60000 // ms between reservation attempts until the coordinator accepts one
+#define reserve_sleep 600000 // ms before own slot in which the node stops negotiating and waits for the grant
 //****************************************Network Specific Ends*******************************************//
 
 # define max_Battery_Voltage 13600 // maximum battery voltage
 # define min_Battery_Voltage 11500 // minimum battery voltage
+#define critical_soc 15 // SOC below which the coordinator is asked directly
+#define nominal_soc 30 // SOC at or below which the network negotiation starts
+#define forecast_window 16 // SOC samples in the forecaster sliding window
+#define forecast_sample 30000 // ms between forecaster samples
+#define forecast_freq 30000 // ms between forecasts sent to the coordinator
+#define forecast_horizon 300 // s, negotiation starts early when nominal_soc is predicted within this time
+#define forecast_none 0xFFFF // time to threshold when the battery is not depleting
 bool data_available = 0; // flag for data availibility from wifi to UART
 float temperature; // variable to store temperature
 char _recv_buf[200]; // Wifi received data store buffer
 bool waiting = false; // flag to check if the node is expeting any network objection
 uint16_t index = 0; // counter to store network message in _recv_buf
-bool charging = 0; // local flag to indicate charger acquired or not.
-bool critical = 0; // flag to indicate if the charge threshold is < critical value
-bool n_critical = 0; // flag to indicate charge is less than nominal value 
-bool toggle = false; // flag to indicate LED toggling.
+bool booked = false; // flag to indicate a reserved charging slot is held
+uint64_t slot_start = 0; // start of the reserved slot, clock_ms() based
+uint64_t hold_off = 0; // no charge request to the coordinator before this time, clock_ms() based
 typedef struct {
-  uint8_t id; // stores ID
+  uint16_t id; // stores ID
   uint16_t status; // stores State of charge
 }
 message_t; // structure for transmit message from Main to Uart_to_Wifi
 typedef struct {
-  uint8_t id;
+  uint16_t id;
   uint8_t bd;
   uint16_t status;
 }
 message_r; // structure for receive message from Uart_to_Wifi
+typedef struct {
+  uint16_t soc; // battery SOC
+  uint16_t current; // battery current, 0.1A
+  float temp; // motor temperature
+  uint16_t ttc; // forecast seconds to nominal_soc
+}
+telemetry_t; // sensor sample published by Main to Uart_to_Wifi
 
 //-----------------------------------------Function Prototypes--------------------------------------
 
@@ -66,6 +168,10 @@ void heartbeat(); // System Health information
 uint64_t clock_ms(); // Returns system time
 uint16_t map(uint16_t, uint16_t, uint16_t, uint16_t, uint16_t); // Maps one range of values to another range.
 unsigned int atoi2(char * ); // alternate implementation of char to int.
+bool worth_Negotiating(); // picks a coordinator and checks its advert
+void token_Step(); // token arbitration round
+void token_Pass(); // hands the token to the neediest other member
+uint32_t objection_Window(); // objection window length in ms
 
 //------------------------------------------Necessary Objects spawning------------------------------
 
@@ -82,6 +188,7 @@ Serial pc(PA_9, PA_10); // Debug UART
 Serial wifi(PA_2, PA_3); // Uart to communicate with ESP8266
 AnalogIn Current(PC_2); //Analog Potentiometer
 Thread Network; //MBED:: Thread to run Uart_to_Wifi function.
+FlashIAP flash; // internal flash holding the telemetry log
 
 MemoryPool < message_t, 32 > mpool; // TX memory allocation
 MemoryPool < message_r, 32 > mpool1; // RX memory allocation
@@ -92,7 +199,7 @@ Queue < message_r, 100 > queue1; // RX queue init
 // For better understanding Please refer project document.
 class Node {
   private:
-  uint8_t node_ID; // Node ID
+  uint16_t node_ID; // Node ID
   uint16_t battery_Voltage; //Node Battery Voltage<-Potentiometer
   uint16_t battery_Current; //Node Battery Current<-Potensiometer
   uint8_t coolant_Level; // From CAN Message -- currently disabled
@@ -107,8 +214,10 @@ class Node {
   uint16_t battery_min_v; //minimum battery voltage
   float battery_temp; // battery temperature
   uint16_t battery_Status; // battery SOC
+  uint32_t tx_Negotiation; // negotiation frames sent (broadcasts, objections, requests)
+  uint16_t charges; // completed charge sessions
   public:
-    Node(uint8_t n_id, uint16_t max_v, uint16_t min_v) //Constructor
+    Node(uint16_t n_id, uint16_t max_v, uint16_t min_v) //Constructor
   {
     node_ID = n_id;
     battery_Voltage = 0;
@@ -124,6 +233,14 @@ class Node {
     battery_min_v = min_v;
     battery_temp = 0;
     battery_Status = 0;
+    tx_Negotiation = 0;
+    charges = 0;
+  }
+  void count_Tx() {
+    tx_Negotiation++;
+  }
+  void count_Charge() {
+    charges++;
   }
   void set_charging(bool charge) {
     charging = charge;
@@ -131,7 +248,7 @@ class Node {
   bool get_charging() {
     return charging;
   }
-  uint8_t get_nodeID() {
+  uint16_t get_nodeID() {
     return node_ID;
   }
   void set_Voltage(uint16_t voltage) {
@@ -175,20 +292,22 @@ class Node {
   uint8_t get_VehicleSpeed() {
     return vehicle_Speed;
   }
-  uint8_t calculate_BatteryStatus(uint16_t battery_Voltage) // calculate SOC Refer report for More insight
+  uint8_t calculate_BatteryStatus(uint16_t battery_Voltage) // calculate SOC Refer report for More insight, stores nothing (called by the sampling thread)
   {
-    battery_Status = ((battery_Voltage - battery_min_v) * 100) / (battery_max_v - battery_min_v);
-    return battery_Status;
+    return ((battery_Voltage - battery_min_v) * 100) / (battery_max_v - battery_min_v);
+  }
+  void set_BatteryStatus(uint16_t status) {
+    battery_Status = status;
   }
   uint16_t get_BatteryStatus() {
     return battery_Status;
   }
   char * get_Status() // Dashboard Specific Message
   {
-    sprintf(buf, "%d,%d,%d,%d,%0.2f,%0.2f,%d,%d", node_ID, battery_Current, battery_Status, coolant_Level, m1_temp, m2_temp, error_State, charging);
+    sprintf(buf, "%d,%d,%d,%d,%0.2f,%0.2f,%d,%d,%lu,%d", node_ID, battery_Current, battery_Status, coolant_Level, m1_temp, m2_temp, error_State, charging, (unsigned long) tx_Negotiation, charges);
     return buf;
   }
-  bool remote_Objection(uint8_t id, uint16_t rbattery_Status) // function to decide to deny remote node charger acquiring
+  bool remote_Objection(uint16_t id, uint16_t rbattery_Status) // function to decide to deny remote node charger acquiring
   {
     if (battery_Status < rbattery_Status) {
       node_ACK = 1;
@@ -206,9 +325,683 @@ class Node {
   }
 };
 
+//------------------------------------Snapshot Class Starts Here--------------------------------------
+// Latest record of one writer thread, read by another without locks (double buffered seqlock). The
+// writer fills the slot readers are not pointed at and then bumps the sequence, so a reader never waits
+// for a write in progress and never sees a torn record; it copies again only if a publish lands meanwhile.
+template < typename T >
+  class Snapshot {
+    private:
+      T slots[2]; // published record and the one being written
+    volatile uint32_t seq; // publishes so far, slot seq & 1 is the published one
+    public:
+      Snapshot() {
+        memset(slots, 0, sizeof(slots));
+        seq = 0;
+      }
+    void write(const T & value) { // single writer
+      slots[(seq + 1) & 1] = value;
+      __DMB(); // record complete before it is published
+      seq = seq + 1;
+    }
+    T read() {
+      T value;
+      uint32_t s;
+      do {
+        s = seq;
+        __DMB();
+        value = slots[s & 1];
+        __DMB();
+      } while (seq != s); // a publish during the copy may have started on this slot
+      return value;
+    }
+    bool is_Written() { // false until the first publish
+      return seq != 0;
+    }
+  };
+
+//------------------------------------Flag Class Starts Here------------------------------------------
+// Flag shared between the main and network threads, taken (tested and cleared) in one atomic step.
+class Flag {
+  private:
+    volatile uint8_t value;
+  public:
+    Flag() {
+      value = 0;
+    }
+  void set() {
+    value = 1;
+  }
+  void clear() {
+    value = 0;
+  }
+  bool get() {
+    return value;
+  }
+  bool take() { // true if it was set, cleared in the same step
+    uint8_t expected = 1;
+    return core_util_atomic_cas_u8( & value, & expected, 0);
+  }
+};
+
+//------------------------------------Forecaster Class Starts Here------------------------------------
+// Least squares SOC trend over a sliding window of samples, all in fixed point. The slope (Q16 %/s)
+// is exponentially smoothed and scaled by the latest current over the window mean current, so a
+// forklift picking up load is forecast to deplete faster before the SOC trend shows it.
+class Forecaster {
+  private:
+    uint32_t t[forecast_window]; // sample time in seconds
+  uint8_t soc[forecast_window]; // sample SOC
+  uint16_t current[forecast_window]; // sample battery current
+  uint8_t head; // next slot to overwrite
+  uint8_t count; // number of valid samples
+  int32_t slope; // smoothed SOC slope, Q16 %/s
+  uint16_t ttc; // predicted seconds to nominal_soc
+  public:
+    Forecaster() {
+      head = 0;
+      count = 0;
+      slope = 0;
+      ttc = forecast_none;
+    }
+  void add_Sample(uint32_t t_s, uint8_t s, uint16_t i) {
+    t[head] = t_s;
+    soc[head] = s;
+    current[head] = i;
+    head = (head + 1) % forecast_window;
+    if (count < forecast_window) {
+      count++;
+    }
+    if (count < 3) {
+      return;
+    }
+    int64_t st = 0, ss = 0, stt = 0, sts = 0, si = 0;
+    uint32_t t0 = t[head % count]; // oldest sample, keeps the sums small
+    for (uint8_t k = 0; k < count; k++) {
+      int64_t x = t[k] - t0;
+      st += x;
+      ss += soc[k];
+      stt += x * x;
+      sts += x * soc[k];
+      si += current[k];
+    }
+    int64_t den = count * stt - st * st;
+    if (den == 0) {
+      return;
+    }
+    int32_t fit = (int32_t)((count * sts - st * ss) * 65536 / den);
+    slope += (fit - slope) / 4; // exponential smoothing, alpha = 1/4
+    int64_t rate = -(int64_t) slope; // Q16 %/s of discharge
+    if (si > 0) {
+      rate = rate * i * count / si; // scale by current load against window mean
+    }
+    if (rate <= 0 || s <= nominal_soc) {
+      ttc = (s <= nominal_soc) ? 0 : forecast_none;
+      return;
+    }
+    int64_t secs = (int64_t)(s - nominal_soc) * 65536 / rate;
+    ttc = secs > forecast_none - 1 ? forecast_none - 1 : (uint16_t) secs;
+  }
+  uint16_t get_TTC() { // seconds until nominal_soc is reached, forecast_none if not depleting
+    return ttc;
+  }
+};
+
+//------------------------------------Zones Class Starts Here-----------------------------------------
+// Availability adverts of every coordinator heard on the network. The home zone coordinator is used
+// until its queue saturates, then two random fresh coordinators are compared and the less loaded one
+// is taken (power of two choices), which spreads the fleet without every node herding to the same
+// "best" coordinator on stale information.
+typedef struct {
+  uint16_t id; // coordinator id
+  bool busy; // charger taken
+  uint8_t queue_len; // queued requests
+  uint8_t queue_soc; // lowest queued SOC
+  uint64_t seen; // advert time, clock_ms() based
+}
+coord_t;
+
+class Zones {
+  private:
+    coord_t coords[max_Coordinators]; // known coordinators
+  uint8_t count; // number of known coordinators
+  uint8_t load(coord_t * c) {
+    return c -> busy + c -> queue_len;
+  }
+  bool fresh(coord_t * c, uint64_t now) {
+    return now - c -> seen < avail_stale;
+  }
+  public:
+    Zones() {
+      count = 0;
+    }
+  void update(uint16_t id, bool busy, uint8_t queue_len, uint8_t queue_soc, uint64_t now) {
+    coord_t * c = get(id);
+    if (c == NULL) {
+      if (count == max_Coordinators) {
+        return;
+      }
+      c = & coords[count++];
+      c -> id = id;
+    }
+    c -> busy = busy;
+    c -> queue_len = queue_len;
+    c -> queue_soc = queue_soc;
+    c -> seen = now;
+  }
+  coord_t * get(uint16_t id) { // advert of a coordinator, NULL if never heard
+    for (uint8_t i = 0; i < count; i++) {
+      if (coords[i].id == id) {
+        return & coords[i];
+      }
+    }
+    return NULL;
+  }
+  coord_t * get_Fresh(uint16_t id, uint64_t now) { // advert of a coordinator, NULL if unknown or stale
+    coord_t * c = get(id);
+    return (c != NULL && fresh(c, now)) ? c : NULL;
+  }
+  bool is_Coordinator(uint16_t id) {
+    return id == home_coordinator || get(id) != NULL;
+  }
+  uint16_t pick(uint64_t now) { // coordinator to negotiate with
+    coord_t * home = get(home_coordinator);
+    if (home == NULL || !fresh(home, now) || home -> queue_len < zone_saturation) {
+      return home_coordinator;
+    }
+    coord_t * a = & coords[rand() % count];
+    coord_t * b = & coords[rand() % count];
+    if (!fresh(a, now)) {
+      a = home;
+    }
+    if (!fresh(b, now)) {
+      b = home;
+    }
+    return load(a) <= load(b) ? a -> id : b -> id;
+  }
+};
+
+//------------------------------------Ring Class Starts Here------------------------------------------
+// Nodes needing charge for token passing arbitration. Only the token holder talks to the coordinator
+// and it hands the token straight to the lowest SOC member, so a charge costs a join, a few token hops
+// and a leave instead of one objection from every lower SOC node per broadcast. Members join at the
+// holder's own topic, so the table is only complete on the holder; the other nodes hear the holder
+// refresh alone.
+typedef struct {
+  uint16_t id; // member node
+  uint8_t soc; // member SOC at its last join
+  uint64_t seen; // last join, clock_ms() based
+}
+member_t;
+
+class Ring {
+  private:
+    member_t members[max_Members]; // nodes needing charge
+  uint8_t count; // number of members
+  bool before(uint16_t id_a, uint8_t soc_a, uint16_t id_b, uint8_t soc_b) { // SOC order, ties by id
+    return soc_a < soc_b || (soc_a == soc_b && id_a < id_b);
+  }
+  public:
+    Ring() {
+      count = 0;
+    }
+  void update(uint16_t id, uint8_t soc, uint64_t now) {
+    uint8_t i = 0;
+    while (i < count && members[i].id != id) {
+      i++;
+    }
+    if (i == count) {
+      if (count == max_Members) {
+        return;
+      }
+      count++;
+    }
+    members[i].id = id;
+    members[i].soc = soc;
+    members[i].seen = now;
+  }
+  void remove(uint16_t id) {
+    for (uint8_t i = 0; i < count; i++) {
+      if (members[i].id == id) {
+        members[i] = members[--count];
+        return;
+      }
+    }
+  }
+  void expire(uint64_t now) {
+    for (uint8_t i = count; i > 0; i--) {
+      if (now - members[i - 1].seen > member_ttl) {
+        members[i - 1] = members[--count];
+      }
+    }
+  }
+  uint16_t neediest(uint16_t self, uint8_t soc) { // member to hold the token, self included
+    uint16_t id = self;
+    for (uint8_t i = 0; i < count; i++) {
+      if (members[i].id != self && before(members[i].id, members[i].soc, id, soc)) {
+        id = members[i].id;
+        soc = members[i].soc;
+      }
+    }
+    return id;
+  }
+};
+
+//------------------------------------Peers Class Starts Here-----------------------------------------
+// Recently seen SOC of the other nodes, fed by the peer topic (only nodes at or below nominal_soc publish)
+// and by broadcasts on the wire. Every needy peer refreshes its own entry within peer_refresh, so once the
+// bridge has been online for peer_stale the table holds all of them and the node decides on its own.
+typedef struct {
+  uint8_t soc; // peer SOC
+  bool charging; // peer holds a charger
+}
+peer_t;
+
+class Peers {
+  private:
+    NodeTable < peer_t, max_Peers, peer_stale > peers; // peer SOC table
+  uint64_t live; // bridge online without a break since, 0 -> offline, clock_ms() based
+  uint64_t heard; // last link frame of the bridge, clock_ms() based
+  public:
+    Peers() {
+      live = 0;
+      heard = 0;
+    }
+  void update(uint16_t id, uint8_t soc, bool charging, uint64_t now) {
+    peer_t * p = peers.insert(id, now);
+    if (p != NULL) {
+      p -> soc = soc;
+      p -> charging = charging;
+    }
+  }
+  void link(bool up, uint64_t now) { // bridge link state, peer frames may be lost while it is down
+    heard = now;
+    if (!up) {
+      live = 0;
+    } else if (live == 0) {
+      live = now;
+    }
+  }
+  void sweep(uint64_t now) {
+    peers.sweep(now);
+  }
+  bool fresh(uint64_t now) { // table good enough to decide without a broadcast round, stale entries are skipped per peer
+    return live != 0 && now - live >= peer_stale && now - heard <= link_timeout;
+  }
+  bool neediest(uint16_t self, uint8_t soc, uint64_t now) { // no fresh competing peer below self
+    for (uint16_t i = 0; i < max_Peers; i++) {
+      uint16_t id = peers.key(i);
+      peer_t * p = peers.at(i);
+      if (id == 0 || id == self || p -> charging || p -> soc > nominal_soc || peers.age(i, now) >= peer_stale) {
+        continue;
+      }
+      if (p -> soc < soc || (p -> soc == soc && id < self)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+//------------------------------------Rtt Class Starts Here-------------------------------------------
+// Recent request to reply times of the coordinator, the objection window is sized from a percentile.
+class Rtt {
+  private:
+    uint16_t samples[rtt_samples]; // round trips in ms, circular
+  uint8_t count; // valid samples
+  uint8_t pos; // next slot to overwrite
+  public:
+    Rtt() {
+      count = 0;
+      pos = 0;
+    }
+  void add(uint16_t ms) {
+    samples[pos] = ms;
+    pos = (pos + 1) % rtt_samples;
+    if (count < rtt_samples) {
+      count++;
+    }
+  }
+  uint16_t percentile(uint8_t p) {
+    uint16_t sorted[rtt_samples];
+    if (count == 0) {
+      return rtt_default;
+    }
+    for (uint8_t i = 0; i < count; i++) { // insertion sort, a handful of samples
+      uint8_t j = i;
+      for (; j > 0 && sorted[j - 1] > samples[i]; j--) {
+        sorted[j] = sorted[j - 1];
+      }
+      sorted[j] = samples[i];
+    }
+    return sorted[(count - 1) * p / 100];
+  }
+};
+
+//------------------------------------Clock Class Starts Here-----------------------------------------
+// Network timebase, the clock of the time_master coordinator estimated from NTP style exchanges over
+// MQTT. Of the last exchanges the one with the lowest round trip gives the offset, with half its round
+// trip as error bound; offsets drift_baseline apart give the drift (ppm) applied between exchanges. An
+// offset outside the bounds of the prediction (master restarted or failed over) restarts the estimate.
+class Clock {
+  private:
+    int32_t offsets[time_samples]; // master minus local clock per exchange, ms
+  uint16_t rtts[time_samples]; // round trip per exchange, ms
+  uint64_t stamps[time_samples]; // local time of each exchange
+  uint8_t count; // valid exchanges
+  uint8_t pos; // next slot to overwrite
+  int32_t offset; // offset in use, ms
+  uint64_t ref; // local time the offset in use was measured at
+  uint16_t error; // half round trip of the offset in use, ms
+  int32_t drift; // master clock rate against the local clock, ppm
+  int32_t base_offset; // offset at the start of the drift baseline
+  uint64_t base_ref; // local time of the start of the drift baseline
+  bool synced; // an offset is in use
+  bool drifted; // a drift has been measured
+  int32_t predict(uint64_t local) { // offset at a local time
+    return offset + (int32_t)((int64_t) drift * (int64_t)(local - ref) / 1000000);
+  }
+  public:
+    Clock() {
+      count = 0;
+      pos = 0;
+      offset = 0;
+      ref = 0;
+      error = time_unsynced;
+      drift = 0;
+      synced = false;
+      drifted = false;
+    }
+  void sample(uint32_t t1, uint32_t t2, uint32_t t3, uint64_t t4) { // request sent, served, replied, reply received
+    uint32_t rtt = ((uint32_t) t4 - t1) - (t3 - t2);
+    if (rtt >= time_unsynced) {
+      return; // stale reply
+    }
+    offsets[pos] = (int32_t)(((int64_t)(int32_t)(t2 - t1) + (int32_t)(t3 - (uint32_t) t4)) / 2);
+    rtts[pos] = rtt;
+    stamps[pos] = t4;
+    pos = (pos + 1) % time_samples;
+    if (count < time_samples) {
+      count++;
+    }
+    uint8_t best = 0;
+    for (uint8_t k = 1; k < count; k++) {
+      if (rtts[k] < rtts[best]) {
+        best = k;
+      }
+    }
+    if (synced && stamps[best] == ref) {
+      return; // estimate unchanged
+    }
+    int32_t step = offsets[best] - predict(stamps[best]);
+    if (synced && (step > error + rtts[best] / 2 + 1 || -step > error + rtts[best] / 2 + 1)) { // master clock jumped
+      offsets[0] = offsets[best];
+      rtts[0] = rtts[best];
+      stamps[0] = stamps[best];
+      best = 0;
+      count = 1;
+      pos = 1 % time_samples;
+      synced = false;
+      drifted = false;
+      drift = 0;
+    }
+    offset = offsets[best];
+    ref = stamps[best];
+    error = rtts[best] / 2;
+    if (!synced) {
+      synced = true;
+      base_offset = offset;
+      base_ref = ref;
+    } else if (ref - base_ref >= drift_baseline) {
+      int32_t d = (int32_t)((int64_t)(offset - base_offset) * 1000000 / (int64_t)(ref - base_ref));
+      drift = drifted ? drift + (d - drift) / 4 : d; // exponential smoothing, alpha = 1/4
+      drifted = true;
+      base_offset = offset;
+      base_ref = ref;
+    }
+  }
+  bool is_Synced() {
+    return synced;
+  }
+  uint32_t now(uint64_t local) { // network time in ms, wraps at 2^32
+    return (uint32_t)(local + predict(local));
+  }
+  uint16_t get_Error(uint64_t local) { // bound of the network time error in ms
+    if (!synced) {
+      return time_unsynced;
+    }
+    uint64_t bound = error + (local - ref) * drift_bound / 1000000;
+    return bound < time_unsynced ? (uint16_t) bound : time_unsynced - 1;
+  }
+};
+
+//------------------------------------Recorder Class Starts Here--------------------------------------
+// Telemetry samples taken while the bridge is offline, kept in a ring of flash sectors written in turn
+// (each sector is erased once per pass, which levels the wear). Every sector starts with a header holding
+// its sequence number; a replayed record has its sent byte programmed from 0xFF to 0, which needs no
+// erase. Sent records form a prefix of the ring and written records a prefix of each sector, so the boot
+// mount reads the sector headers and binary searches both ends instead of scanning the log.
+typedef struct {
+  uint16_t magic; // log_magic once written
+  uint8_t seq; // low byte of the sector sequence, stale sector data never matches
+  uint8_t sent; // 0xFF until replayed, then 0
+  uint32_t time; // network time of the sample, ms (sector sequence in the header)
+  uint16_t error; // network time error bound, ms
+  uint16_t current; // battery current, 0.1A
+  uint8_t soc; // battery SOC
+  int8_t temp; // motor temperature
+  uint8_t flags; // bit 0 charging, log_head in the sector header
+  uint8_t check; // xor of the bytes above except sent
+}
+sample_t;
+
+class Recorder {
+  private:
+    uint32_t size; // sector size
+  uint32_t cap; // records per sector after the header
+  uint8_t head; // sector being written
+  uint32_t head_off; // next free record offset in the head sector
+  uint32_t seq; // sequence of the head sector
+  uint8_t tail; // sector of the oldest unsent record
+  uint32_t tail_off; // offset of the oldest unsent record
+  uint32_t lost; // unsent samples overwritten by the ring
+  bool ready; // flash initialised and mounted
+  uint32_t addr(uint8_t sector, uint32_t off) {
+    return log_base + sector * size + off;
+  }
+  uint8_t checksum(sample_t * r) {
+    uint8_t * b = (uint8_t * ) r;
+    uint8_t x = 0;
+    for (uint8_t i = 0; i < sizeof(sample_t) - 1; i++) {
+      if (i != offsetof(sample_t, sent)) {
+        x ^= b[i];
+      }
+    }
+    return x;
+  }
+  bool valid(sample_t * r, uint32_t s) {
+    return r -> magic == log_magic && r -> seq == (s & 0xFF) && r -> check == checksum(r);
+  }
+  bool header(uint8_t sector, uint32_t * s) { // reads a sector header, false if the sector is not in the log
+    sample_t r;
+    flash.read( & r, addr(sector, 0), sizeof(r));
+    if (r.magic != log_magic || r.flags != log_head || r.check != checksum( & r)) {
+      return false;
+    }
+    * s = r.time;
+    return true;
+  }
+  void program(sample_t * r) {
+    r -> magic = log_magic;
+    r -> seq = seq;
+    r -> sent = 0xFF;
+    r -> check = checksum(r);
+    flash.program(r, addr(head, head_off), sizeof(sample_t));
+    head_off += sizeof(sample_t);
+  }
+  void start(uint8_t sector, uint32_t s) { // erases a sector and makes it the head
+    sample_t r;
+    memset( & r, 0, sizeof(r));
+    flash.erase(addr(sector, 0), size);
+    head = sector;
+    head_off = 0;
+    seq = s;
+    r.time = s;
+    r.flags = log_head;
+    program( & r);
+  }
+  bool unsent(uint8_t sector, uint32_t off, uint32_t s) {
+    sample_t r;
+    flash.read( & r, addr(sector, off), sizeof(r));
+    return valid( & r, s) && r.sent == 0xFF;
+  }
+  public:
+    Recorder() {
+      ready = false;
+      lost = 0;
+    }
+  void mount() { // finds the head and the oldest unsent record, a few dozen reads
+    uint32_t s[log_sectors];
+    bool ok[log_sectors];
+    uint8_t newest = log_sectors;
+    if (flash.init() != 0) {
+      return;
+    }
+    size = flash.get_sector_size(log_base);
+    cap = size / sizeof(sample_t) - 1;
+    for (uint8_t k = 0; k < log_sectors; k++) {
+      ok[k] = header(k, & s[k]);
+      if (ok[k] && (newest == log_sectors || (int32_t)(s[k] - s[newest]) > 0)) {
+        newest = k;
+      }
+    }
+    ready = true;
+    if (newest == log_sectors) { // blank flash, start the first pass
+      start(0, 1);
+      tail = head;
+      tail_off = head_off;
+      return;
+    }
+    head = newest;
+    seq = s[newest];
+    uint32_t lo = 0, hi = cap; // written records of the head sector
+    while (lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+      sample_t r;
+      flash.read( & r, addr(head, (mid + 1) * sizeof(sample_t)), sizeof(r));
+      if (valid( & r, seq)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    head_off = (lo + 1) * sizeof(sample_t);
+    uint8_t first = log_sectors - 1; // sectors in ring order, oldest first, carrying consecutive sequences
+    while (first > 0) {
+      uint8_t k = (head + first) % log_sectors;
+      if (!ok[k] || s[k] != seq - (log_sectors - first)) {
+        break;
+      }
+      first--;
+    }
+    first++; // oldest sector in the log is (head + first) % log_sectors, the head is position log_sectors
+    uint32_t total = (log_sectors - first) * cap + lo;
+    lo = 0;
+    hi = total;
+    while (lo < hi) { // first unsent record over the whole log
+      uint32_t mid = (lo + hi) / 2;
+      uint8_t k = (head + first + mid / cap) % log_sectors;
+      if (!unsent(k, (mid % cap + 1) * sizeof(sample_t), seq - (log_sectors - first - mid / cap))) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo == total) {
+      tail = head;
+      tail_off = head_off;
+    } else {
+      tail = (head + first + lo / cap) % log_sectors;
+      tail_off = (lo % cap + 1) * sizeof(sample_t);
+    }
+  }
+  void append(uint32_t time, uint16_t error, uint16_t current, uint8_t soc, int8_t temp, bool charging) {
+    sample_t r;
+    if (!ready) {
+      return;
+    }
+    if (head_off + sizeof(sample_t) > size) { // next sector of the ring, the oldest samples give way
+      uint8_t next = (head + 1) % log_sectors;
+      if (tail == next && pending()) {
+        lost += (size - tail_off) / sizeof(sample_t);
+        tail = (next + 1) % log_sectors;
+        tail_off = sizeof(sample_t);
+      }
+      bool drained = !pending();
+      start(next, seq + 1);
+      if (drained) {
+        tail = head;
+        tail_off = head_off;
+      }
+    }
+    r.time = time;
+    r.error = error;
+    r.current = current;
+    r.soc = soc;
+    r.temp = temp;
+    r.flags = charging;
+    program( & r);
+  }
+  bool pending() { // samples left to replay
+    return ready && (tail != head || tail_off != head_off);
+  }
+  bool next(sample_t * r) { // takes the oldest unsent sample and marks it sent, false if none or torn
+    if (!pending()) {
+      return false;
+    }
+    flash.read(r, addr(tail, tail_off), sizeof(sample_t));
+    bool ok = valid(r, seq - (head + log_sectors - tail) % log_sectors);
+    uint8_t sent = 0;
+    flash.program( & sent, addr(tail, tail_off) + offsetof(sample_t, sent), 1); // clears bits only, no erase
+    tail_off += sizeof(sample_t);
+    if (tail != head && tail_off + sizeof(sample_t) > size) {
+      tail = (tail + 1) % log_sectors;
+      tail_off = sizeof(sample_t);
+    }
+    return ok;
+  }
+  uint32_t get_Lost() {
+    return lost;
+  }
+};
+
 Node mynode(ID, max_Battery_Voltage, min_Battery_Voltage); // Initialization of Class Node with id,min_battery_voltage,max_battery_voltage 
+Snapshot < telemetry_t > sensors; // latest sensor sample, written by Main only
+Flag charging; // charger acquired, set by Uart_to_Wifi
+Flag critical; // charge below critical_soc, set by Main and taken by Uart_to_Wifi
+Flag n_critical; // charge at or below nominal_soc (or forecast to be soon), set by Main and taken by Uart_to_Wifi
+Forecaster forecast; // SOC depletion forecaster
+Zones zones; // coordinator adverts per zone
+Ring ring; // nodes needing charge, token arbitration
+Peers peers; // recently seen SOC of the other nodes
+Rtt rtt; // coordinator round trips
+Clock netclock; // network timebase
+Recorder recorder; // telemetry kept while the bridge is offline
+bool link_state = true; // bridge connected to the broker, as last reported by the bridge
+uint64_t link_seen = 0; // last link frame from the bridge, clock_ms() based
+bool in_ring = false; // flag to indicate this node joined the ring
+bool has_token = false; // flag to indicate this node holds the token
+uint16_t token_seq = 0; // highest token sequence seen
+uint16_t holder_id = 0; // token holder joins and leaves go to, 0 -> not known
+bool rejoin = false; // join the new holder at the next token step
+uint64_t token_seen = 0; // last token activity, clock_ms() based
+uint8_t replies = 0; // objections heard in the current broadcast round
+uint64_t window_end = 0; // close of the objection window, clock_ms() based
+uint64_t rtt_start = 0; // last charge request to the coordinator, 0 -> no reply pending
 int main() {
   char local_buf[10];
+  telemetry_t sample; // latest sensor sample, owned by this thread
+  memset( & sample, 0, sizeof(sample));
   // start heartbeat LED
   //Init all LED as HIGH
   myled = 1;
@@ -218,28 +1011,50 @@ int main() {
   // Init UART Communication with baud rate 9600
   pc.baud(9600);
   wifi.baud(9600);
+#if DEVICE_TRNG
+  trng_t trng; // hardware random seed, nodes powered up together get different jitter
+  uint32_t seed = 0;
+  size_t len = 0;
+  trng_init( & trng);
+  trng_get_bytes( & trng, (uint8_t * ) & seed, sizeof(seed), & len);
+  trng_free( & trng);
+  srand(seed ^ ID ^ us_ticker_read());
+#else
+  srand(ID + us_ticker_read()); // nodes must not pick the same coordinators in lock step
+#endif
+  recorder.mount(); // a few flash reads, boot time unaffected by the log size
   // Start networking thread
   Network.start(Uart_to_Wifi);
   // local variables 
-  unsigned long time_t = 0, time_t1 = 0;
+  uint64_t time_t = 0, time_t1 = 0, time_t2 = 0; // timer variables, clock_ms() based
   time_t = clock_ms();
   time_t1 = clock_ms();
+  time_t2 = clock_ms();
 
   //message_r *message1 = mpool1.alloc();
   while (1) {
 
     while (clock_ms() > time_t) { // timeout loop to calculate Battery SOC
       time_t = clock_ms() + 3000;
-      mynode.calculate_BatteryStatus(map(Voltage.read_u16(), 0, 65535, 11500, 13600));
-      mynode.set_Moto2(temp.read() * 3.685503686 * 100);
+      sample.soc = mynode.calculate_BatteryStatus(map(Voltage.read_u16(), 0, 65535, 11500, 13600));
+      sample.temp = temp.read() * 3.685503686 * 100;
+      sample.current = map(Current.read_u16(), 0, 65535, 0, 1000); // 0.1A resolution
+      sample.ttc = forecast.get_TTC();
+      sensors.write(sample); // network thread sees the whole sample or the previous one
       //pc.printf("%d Node ACK=%d\n",,mynode.get_Node_Ack());
     }
+    while (clock_ms() > time_t2) { // timeout loop to feed the depletion forecaster
+      time_t2 = clock_ms() + forecast_sample;
+      forecast.add_Sample(clock_ms() / 1000, sample.soc, sample.current);
+    }
     while (clock_ms() > time_t1) { // timeout loop to check if charge is less than threshold
       time_t1 = clock_ms() + 1000;
-      if (mynode.get_BatteryStatus() < 15 && !charging) { // timeout loop to check if SOC is less than critical
-        critical = 1; // set critical True
-      } else if (mynode.get_BatteryStatus() <= 30 && !charging) { //timeout loop to check if SOC is less then nominal
-        n_critical = 1; //set nominal flag
+      if (sample.soc < critical_soc && !charging.get()) { // timeout loop to check if SOC is less than critical
+        critical.set(); // set critical True
+      } else if (sample.soc <= nominal_soc && !charging.get()) { //timeout loop to check if SOC is less then nominal
+        n_critical.set(); //set nominal flag
+      } else if (forecast.get_TTC() < forecast_horizon && !charging.get()) { // nominal threshold predicted soon, negotiate early
+        n_critical.set();
       }
     }
     Thread::wait(1); // wait for 1 ms :)
@@ -250,20 +1065,107 @@ void Uart_to_Wifi() {
   //local varaibles
   char c; // variable to store one char received from ESP8266
   char local_buf[10]; // local buffer to store ID/SOC/Destination
-  uint8_t id = 0; // local variable to store remote ID
+  uint16_t id = 0; // local variable to store remote ID
   uint8_t stat = 0; // local variable to store remote SOC
+  uint8_t op = 0; // local variable to store message opcode
+  uint32_t arg1 = 0, arg2 = 0; // local variables to store opcode arguments
   char * token; //char array for CSV parsing
-  unsigned long time_t3 = clock_ms(), time_t4 = clock_ms(); // timer variables
+  uint64_t time_t3 = clock_ms(), time_t4 = clock_ms(), time_t5 = clock_ms(), time_t6 = clock_ms(), time_t7 = clock_ms(); // timer variables, clock_ms() based
+  uint64_t rx_time = 0; // arrival of the current frame, time exchange
+  uint64_t time_t8 = 0; // next replayed sample
+  uint64_t time_t9 = clock_ms(); // next charger lease renewal
+  uint64_t dash_sent = 0; // last full dashboard frame
+  uint16_t sent_soc = 0xFFFF, sent_current = 0; // values of the last full dashboard frame
+  float sent_temp = 0;
+  bool sent_charging = false;
+  sample_t sample; // replayed telemetry sample
+  telemetry_t reading; // latest sensor sample of the main thread
+  link_seen = clock_ms();
+  uint16_t soc_pushed = 0xFFFF; // SOC last pushed to the bridge
+  uint16_t peer_sent = 0xFFFF; // SOC of the last peer frame, above nominal_soc -> not publishing
+  bool peer_charging = false; // charging flag of the last peer frame
+  uint64_t time_t10 = 0; // next peer frame refresh
+  while (!sensors.is_Written()) {
+    Thread::wait(1); // no SOC 0 towards the bridge and the peers before the first real sample
+  }
   while (true) {
-    if (clock_ms() > time_t4) { // dashboard message sending after some time
+    reading = sensors.read(); // consistent sample, never waits for the main thread
+    mynode.set_BatteryStatus(reading.soc);
+    mynode.set_Current(reading.current);
+    mynode.set_Moto2(reading.temp);
+    if (mynode.get_BatteryStatus() != soc_pushed) { // bridge objects on our behalf with the latest SOC
+      soc_pushed = mynode.get_BatteryStatus();
+      wifi.printf("%d,%d,%d,%d#", bridge_id, ID, soc_pushed, op_soc);
+    }
+    if ((mynode.get_BatteryStatus() <= nominal_soc || peer_sent <= nominal_soc) && (clock_ms() > time_t10 || mynode.get_BatteryStatus() != peer_sent || charging.get() != peer_charging)) { // needy nodes tell the peers at or above their band, one last frame once above nominal_soc
+      time_t10 = clock_ms() + peer_refresh;
+      peer_sent = mynode.get_BatteryStatus();
+      peer_charging = charging.get();
+      wifi.printf("%d/%d,%d,%d,%d,%d#", peer_id, peer_sent / band_width, ID, peer_sent, op_peer, peer_charging);
+    }
+    if (clock_ms() > time_t6 && !charging.get()) { // share depletion forecast with coordinator
+      time_t6 = clock_ms() + forecast_freq;
+      wifi.printf("%d,%d,%d,%d,%d#", home_coordinator, ID, mynode.get_BatteryStatus(), op_forecast, reading.ttc);
+    }
+    if (booked && clock_ms() > slot_start + reserve_len * 1000ULL) {
+      booked = false; // slot passed unused
+    }
+    if (reserve_after != 0 && !booked && clock_ms() > time_t5) { // book the next shift slot
+      time_t5 = clock_ms() + reserve_retry;
+      wifi.printf("%d,%d,%d,%d,%d,%d#", home_coordinator, ID, mynode.get_BatteryStatus(), op_reserve, reserve_after, reserve_len);
+      pc.printf("Reserve=>%d,%d,%d,%d,%d,%d#\n", home_coordinator, ID, mynode.get_BatteryStatus(), op_reserve, reserve_after, reserve_len); // debug
+    }
+    if (clock_ms() > time_t7) { // time exchange with the master coordinator
+      time_t7 = clock_ms() + (netclock.is_Synced() ? time_freq : time_burst);
+      wifi.printf("%d,%d,%d,%d,%lu#", time_master, ID, mynode.get_BatteryStatus(), op_time, (unsigned long)(uint32_t) clock_ms()); // SOC like every node frame, the bridge objects with it
+    }
+    bool changed = abs(mynode.get_BatteryStatus() - sent_soc) >= soc_deadband || abs(mynode.get_Current() - sent_current) >= current_deadband || mynode.get_Motor2() >= sent_temp + temp_deadband || mynode.get_Motor2() <= sent_temp - temp_deadband || charging.get() != sent_charging;
+    if ((changed && clock_ms() - dash_sent >= dash_min) || clock_ms() - dash_sent >= dash_max) { // full dashboard frame on a significant change, else rarely
+      dash_sent = clock_ms();
+      time_t4 = clock_ms() + dash_freq;
+      sent_soc = mynode.get_BatteryStatus();
+      sent_current = mynode.get_Current();
+      sent_temp = mynode.get_Motor2();
+      sent_charging = charging.get();
+      wifi.printf("$%d,%s,%lu,%u#", disp_id, string(mynode.get_Status()), (unsigned long) netclock.now(clock_ms()), netclock.get_Error(clock_ms())); // send to dashbaord, stamped with network time
+      if (!link_state || clock_ms() - link_seen > link_timeout) { // bridge offline, keep the sample in flash
+        recorder.append(netclock.now(clock_ms()), netclock.get_Error(clock_ms()), sent_current, sent_soc, (int8_t) sent_temp, sent_charging);
+      }
+      pc.printf("$%d,%s,%lu,%u#", disp_id, string(mynode.get_Status()), (unsigned long) netclock.now(clock_ms()), netclock.get_Error(clock_ms())); //send to debug
+    } else if (clock_ms() > time_t4) { // nothing worth reporting, keepalive only
       time_t4 = clock_ms() + dash_freq;
-      wifi.printf("$%d,%s#", disp_id, string(mynode.get_Status())); // send to dashbaord
-      pc.printf("$%d,%s#", disp_id, string(mynode.get_Status())); //send to debug
+      wifi.printf("$%d,%d#", disp_id, ID);
+    }
+    if (charging.get() && clock_ms() > time_t9) { // keep the charger lease alive
+      time_t9 = clock_ms() + dash_freq;
+      wifi.printf("%d,%d,%d,%d#", coordinator_id, ID, mynode.get_BatteryStatus(), op_renew);
+    }
+    if (link_state && clock_ms() - link_seen <= link_timeout && clock_ms() > time_t8 && recorder.pending()) { // replay the outage, paced
+      time_t8 = clock_ms() + log_rate;
+      if (recorder.next( & sample)) {
+        wifi.printf("%d,%d,%d,%d,%lu,%u,%u,%d,%d#", log_id, ID, sample.soc, op_log, (unsigned long) sample.time, sample.error, sample.current, sample.temp, sample.flags & 1);
+      }
+      if (!recorder.pending()) {
+        pc.printf("Telemetry log replayed, %lu samples lost to the ring\n", (unsigned long) recorder.get_Lost()); // debug
+      }
     }
+    if (waiting && clock_ms() >= window_end) { // window closed without a decisive objection
+      myled = 1;
+      buzzer = 1;
+      waiting = 0;
+      if (clock_ms() >= hold_off) { // unless the coordinator asked us to back off
+        wifi.printf("%d,%d,%d#", coordinator_id, mynode.get_nodeID(), mynode.get_BatteryStatus());
+        rtt_start = clock_ms();
+        mynode.count_Tx();
+        pc.printf("Coordinator Ack=>%d,%d,%d#\n", coordinator_id, mynode.get_nodeID(), mynode.get_BatteryStatus());
+      }
+    }
+    peers.sweep(clock_ms()); // expired peers leave a few slots per pass
     if (wifi.readable() == true) {
       c = wifi.getc();
       if (c == '#') {
         index = 0;
+        rx_time = clock_ms();
         //wifi.printf("%s index=%d\n",_recv_buf,index);
         message_t * message = mpool.alloc();
         token = strtok(_recv_buf, ",");
@@ -272,31 +1174,137 @@ void Uart_to_Wifi() {
         token = strtok(NULL, ",");
         stat = atoi(token);
         message -> status = stat;
+        op = op_request; // legacy frames carry no opcode
+        arg1 = 0;
+        arg2 = 0;
+        if ((token = strtok(NULL, ",")) != NULL) op = atoi(token);
+        if ((token = strtok(NULL, ",")) != NULL) arg1 = strtoul(token, NULL, 10);
+        if (op != op_schedule && (token = strtok(NULL, ",")) != NULL) arg2 = strtoul(token, NULL, 10); // schedule entries are parsed below
         //wifi.printf("Received msg id=%d,status=%d#",id,stat);
         queue.put(message);
         mpool.free(message); // send messsage to main thread
-        if (mynode.get_BatteryStatus() < stat) {
-          wifi.printf("%d,%d,%d#", id, ID, mynode.get_BatteryStatus()); // send objection
-          pc.printf("Objecting Remote ID=>%d,my ID=>%d,my status=>%d\n", id, ID, mynode.get_BatteryStatus()); // debug message
+        if (op == op_reserve) { // reservation ack/denial from coordinator
+          booked = stat;
+          slot_start = clock_ms() + arg1 * 1000ULL;
+          pc.printf("Reservation %d in %lus\n", stat, (unsigned long) arg1); // debug
+        } else if (op == op_avail) { // coordinator availability advert
+          zones.update(id, stat, arg1, arg2, clock_ms());
+        } else if (op == op_time && id == time_master) { // time reply: t1,t2,t3
+          if ((token = strtok(NULL, ",")) != NULL) {
+            netclock.sample(arg1, arg2, strtoul(token, NULL, 10), rx_time);
+          }
+        } else if (op == op_link && id == bridge_id) { // bridge link state
+          link_state = stat;
+          link_seen = clock_ms();
+          peers.link(stat, clock_ms());
+        } else if (op == op_peer) { // peer SOC from the peer topic
+          peers.update(id, stat, arg1, clock_ms());
+        } else if (op == op_join) { // ring member joined or refreshed
+          ring.update(id, stat, clock_ms());
+          if (arg1) { // holder refresh counts as token activity
+            token_seen = clock_ms();
+            if (id != holder_id && in_ring && !has_token) {
+              rejoin = true; // the new holder starts with an empty table
+            }
+            holder_id = id;
+            if (has_token && (arg2 > token_seq || (arg2 == token_seq && id < ID))) {
+              has_token = false; // duplicate token after a regeneration, the other one wins
+            }
+            if (arg2 > token_seq) {
+              token_seq = arg2;
+            }
+          }
+        } else if (op == op_leave) { // ring member got the charger
+          ring.remove(id);
+          token_seen = clock_ms();
+        } else if (op == op_token) { // token handed to us
+          if (arg1 >= token_seq) {
+            token_seq = arg1;
+            token_seen = clock_ms();
+            has_token = true;
+            holder_id = ID;
+            rejoin = true; // announce the new holder
+            if (!in_ring) {
+              token_Pass(); // nothing to ask for, keep it moving
+            }
+          }
+        }
+        if (rtt_start != 0 && zones.is_Coordinator(id) && (op == op_request || op == op_busy)) {
+          if (clock_ms() - rtt_start < window_max) { // a queued grant is no round trip sample
+            rtt.add(clock_ms() - rtt_start);
+          }
+          rtt_start = 0;
         }
-        if (id == coordinator_id) { // if message is received from coordinator.
+        if (op == op_busy) { // coordinator is overloaded, back off
+          hold_off = clock_ms() + arg1;
+          if (time_t3 < hold_off) {
+            time_t3 = hold_off; // no new broadcast round before the coordinator can take us
+          }
+          pc.printf("Coordinator busy, retry in %lums\n", (unsigned long) arg1); // debug
+        } else if (op == op_invite) { // charger idle, coordinator invites us ahead of the threshold
+          if (!charging.get()) {
+            coordinator_id = id;
+            wifi.printf("%d,%d,%d#", coordinator_id, mynode.get_nodeID(), mynode.get_BatteryStatus()); // charge request
+            rtt_start = clock_ms();
+            mynode.count_Tx();
+            pc.printf("Invited=>%d,%d,%d#\n", coordinator_id, mynode.get_nodeID(), mynode.get_BatteryStatus()); // debug
+          }
+        } else if (op == op_schedule) { // coordinator schedule, pick up own slot
+          for (uint8_t i = 0; i < arg1 && (token = strtok(NULL, ",")) != NULL; i++) {
+            id = atoi(token); // slot owner
+            token = strtok(NULL, ",");
+            if (id == ID && token != NULL) {
+              booked = true;
+              slot_start = clock_ms() + atoi(token) * 1000ULL;
+            }
+            strtok(NULL, ","); // slot duration
+          }
+        }
+        if ((op == op_request || op == op_object) && !zones.is_Coordinator(id)) {
+          peers.update(id, stat, false, clock_ms()); // broadcasts and objections carry the peer SOC too
+        }
+        if (zones.is_Coordinator(id) && (id == coordinator_id || !charging.get()) && op == op_request) { // if message is received from coordinator.
           if (stat == 0x01) // if coordinator has accepepted charging req
           {
+            coordinator_id = id; // a queued request may be granted by a zone we moved away from
+            if (in_ring) { // leave the ring and hand the token on
+              in_ring = false;
+              if (has_token) {
+                token_Pass();
+              } else {
+                wifi.printf("%d,%d,%d,%d#", holder_id != 0 ? holder_id : token_id, ID, mynode.get_BatteryStatus(), op_leave);
+                mynode.count_Tx();
+              }
+            }
 
             myled = 1; // turn off Green LED
             buzzer = 1; // turn off buzzer
             mynode.set_charging(true);
-            charging = true;
+            charging.set();
           } else {
+            if (charging.get()) {
+              mynode.count_Charge();
+              if (clock_ms() >= slot_start) {
+                booked = false; // slot used, book the next shift
+              }
+            }
             mynode.set_charging(false);
-            charging = false;
+            charging.clear();
           }
+        } else if (zones.is_Coordinator(id) && op == op_request && stat == 0x01) { // second zone granted while we charge elsewhere
+          wifi.printf("%d,%d,%d,%d#", id, ID, mynode.get_BatteryStatus(), op_decline); // hand its charger back at once instead of letting the lease run out
+          mynode.count_Tx();
+        }
+        if (op == op_object && arg1 == ID) {
+          replies++; // objection to our broadcast
         }
-        if (waiting) {
-          waiting = false; // waiting is false
-          mynode.remote_Objection(id, stat); // check remote objection
+        if (waiting && ((op == op_request && !zones.is_Coordinator(id)) || (op == op_object && arg1 == ID))) {
+          if (!mynode.remote_Objection(id, stat)) { // check remote objection
+            waiting = false; // decisive objection, close the window early
+            myled = 1;
+            buzzer = 1;
+          }
           pc.printf("Message Received id=%d,status=%d and ack=%d\n", id, stat, mynode.get_Node_Ack()); // debug
-
         }
       } else {
         // store EPS8266 information here
@@ -304,43 +1312,54 @@ void Uart_to_Wifi() {
         _recv_buf[index + 1] = '\0';
         index += 1;
       }
-    } else if (critical == 1) {
+    } else if (critical.take()) {
       // if critical send message directly to coordinator
-      critical = 0;
+      if (clock_ms() < hold_off) {
+        continue; // coordinator asked us to back off
+      }
+      coordinator_id = zones.pick(clock_ms());
       wifi.printf("%d,%d,%d#", coordinator_id, mynode.get_nodeID(), mynode.get_BatteryStatus()); // sending message to coordinator
+      rtt_start = clock_ms();
+      mynode.count_Tx();
       pc.printf("Coordinator get=>%d,%d,%d#\n", coordinator_id, mynode.get_nodeID(), mynode.get_BatteryStatus()); // debug
-    } else if (n_critical == 1) {
-      n_critical = 0;
-      // if not so critical , broadcast to network for acknowledgement 
-      while (clock_ms() > time_t3 && !waiting) {
-        wifi.printf("255,%d,%d#", mynode.get_nodeID(), mynode.get_BatteryStatus()); // broadcasting in network
-        pc.printf("BroadCast get ACK=>255,%d,%d#\n", mynode.get_nodeID(), mynode.get_BatteryStatus()); //debug
-        //wifi.printf("Timeout from waiting loop\n");
-        mynode.set_Node_Ack(1);
-        time_t3 = clock_ms() + 7000;
-        waiting = true;
-        hb.attach( & heartbeat, 5.0); // start green led blinking till get the charger lock.
-        myled = 0; // turn on the LED
-        buzzer = 0; // turn on the LED
+    } else if (n_critical.take()) {
+      if (booked && clock_ms() + reserve_sleep > slot_start) {
+        // own slot is close, wait for the coordinator grant instead of negotiating
+#if arbitration_token
+      } else {
+        token_Step();
       }
-      if (toggle) // if toggle set by heartbeat --
-      {
-        myled = 1;
-        buzzer = 1;
-        toggle = false;
-        hb.detach();
-        waiting = 0;
-        //wifi.printf("Timeout from ack loop\n");
-        if (mynode.get_Node_Ack()) {
-          wifi.printf("%d,%d,%d#", coordinator_id, mynode.get_nodeID(), mynode.get_BatteryStatus());
-          pc.printf("Coordinator Ack=>%d,%d,%d#\n", coordinator_id, mynode.get_nodeID(), mynode.get_BatteryStatus());
-        } else {
-          wifi.printf("255,%d,%d#", mynode.get_nodeID(), mynode.get_BatteryStatus());
-          pc.printf("BroadCast Non Ack=>255,%d,%d#\n", mynode.get_nodeID(), mynode.get_BatteryStatus());
+#else
+      } else if (!waiting && !worth_Negotiating()) {
+        // charger taken and a needier node is queued, negotiating now would be wasted
+      } else if (!waiting && peers.fresh(clock_ms())) {
+        // peer table is fresh, decide locally
+        if (peers.neediest(ID, mynode.get_BatteryStatus(), clock_ms()) && clock_ms() > time_t3 && clock_ms() >= hold_off) {
+          time_t3 = clock_ms() + peer_retry;
+          wifi.printf("%d,%d,%d#", coordinator_id, ID, mynode.get_BatteryStatus());
+          rtt_start = clock_ms();
+          mynode.count_Tx();
+          pc.printf("Peer Table Ack=>%d,%d,%d#\n", coordinator_id, ID, mynode.get_BatteryStatus()); // debug
         }
-        //wifi.printf("leaving ack\n");
+      } else {
+        // if not so critical , broadcast to network for acknowledgement 
+        while (clock_ms() > time_t3 && !waiting) {
+          pc.printf("Replies to last broadcast=>%d\n", replies); // debug, replies per broadcast
+          replies = 0;
+          wifi.printf("255/%d,%d,%d#", mynode.get_BatteryStatus() / band_width, mynode.get_nodeID(), mynode.get_BatteryStatus()); // broadcasting to nodes that can object
+          mynode.count_Tx();
+          pc.printf("BroadCast get ACK=>255/%d,%d,%d#\n", mynode.get_BatteryStatus() / band_width, mynode.get_nodeID(), mynode.get_BatteryStatus()); //debug
+          //wifi.printf("Timeout from waiting loop\n");
+          mynode.set_Node_Ack(1);
+          window_end = clock_ms() + objection_Window();
+          time_t3 = window_end + round_gap;
+          waiting = true;
+          myled = 0; // turn on the LED till the window closes
+          buzzer = 0; // turn on the LED
+        }
+        Thread::wait(1);
       }
-      Thread::wait(1);
+#endif
     }
   }
 }
@@ -381,6 +1400,96 @@ unsigned int atoi2(char * str) {
   return (unsigned int) number;
 }
 /*
+Function Name: worth_Negotiating()
+Input: N/A
+Base function type: User defined function.
+Return: true if a negotiation round can lead to a charge
+Functionality:
+•   Picks the coordinator to negotiate with from the zone adverts.
+•   Returns false while its charger is taken and a needier node is already queued there.
+*/
+bool worth_Negotiating() {
+  coordinator_id = zones.pick(clock_ms());
+  coord_t * c = zones.get_Fresh(coordinator_id, clock_ms());
+  return c == NULL || !c -> busy || mynode.get_BatteryStatus() < c -> queue_soc;
+}
+/*
+Function Name: objection_Window()
+Input: N/A
+Base function type: User defined function.
+Return: window length in ms
+Functionality:
+•   Latest time a lower SOC objection can arrive: its SOC scaled delay, the jitter and the
+    measured round trip percentile, capped to the former fixed window.
+*/
+uint32_t objection_Window() {
+  uint32_t window = mynode.get_BatteryStatus() * objection_slot + objection_jitter + rtt.percentile(rtt_percentile);
+  return window < window_max ? window : window_max;
+}
+/*
+Function Name: token_Step()
+Input: N/A
+Base function type: User defined function, invoked once per second while charge is needed.
+Return: N/A
+Functionality:
+•   Joins/refreshes the ring at the holder, regenerates a lost token (later for higher SOC bands).
+•   As token holder, refreshes on the ring topic so every member knows where to join.
+•   As token holder, asks the coordinator if this node is the neediest, else passes the token on.
+*/
+void token_Step() {
+  static uint64_t join_t = 0, request_t = 0;
+  uint64_t now = clock_ms();
+  uint8_t soc = mynode.get_BatteryStatus();
+  ring.expire(now);
+  if (!in_ring || now > join_t || rejoin) { // join, holder refreshes faster as its liveness signal
+    in_ring = true;
+    rejoin = false;
+    join_t = now + (has_token ? token_hb : member_refresh);
+    wifi.printf("%d,%d,%d,%d,%d,%d#", has_token || holder_id == 0 ? token_id : holder_id, ID, soc, op_join, has_token, token_seq); // unicast to a known holder
+    mynode.count_Tx();
+  }
+  if (!has_token) {
+    if (now - token_seen < (uint64_t) token_timeout * (soc / band_width + 1)) {
+      return;
+    }
+    has_token = true; // token lost, the lowest SOC band times out first and regenerates it
+    holder_id = ID;
+    token_seq++;
+    token_seen = now;
+    join_t = now; // announce the new holder
+  }
+  if (ring.neediest(ID, soc) != ID) {
+    token_Pass();
+  } else if (now > request_t && now >= hold_off && worth_Negotiating()) {
+    request_t = now + token_retry;
+    wifi.printf("%d,%d,%d#", coordinator_id, ID, soc); // charge request
+    rtt_start = clock_ms();
+    mynode.count_Tx();
+    pc.printf("Token Request=>%d,%d,%d#\n", coordinator_id, ID, soc); // debug
+  }
+}
+/*
+Function Name: token_Pass()
+Input: N/A
+Base function type: User defined function.
+Return: N/A
+Functionality:
+•   Hands the token to the lowest SOC member other than this node, drops it if the ring is empty.
+*/
+void token_Pass() {
+  uint16_t next = ring.neediest(ID, 0xFF);
+  has_token = false;
+  token_seen = clock_ms();
+  if (next != ID) {
+    holder_id = next;
+    rejoin = in_ring; // the new holder has not heard our join
+    wifi.printf("%d,%d,%d,%d,%d#", next, ID, mynode.get_BatteryStatus(), op_token, token_seq);
+    mynode.count_Tx();
+  } else {
+    holder_id = 0; // token dropped, joins go to the ring topic again
+  }
+}
+/*
 Function Name: heartbeat()
 Input: N/A
 Base function type: User defined function, invoked via mbed::timeout interrupt.
@@ -398,8 +1507,9 @@ Base function type: User defined function.
 Return: returns unsigned long
 Functionality:
 •   Returns system on time in milliseconds.
+•   Read from the 64 bit microsecond ticker, so it does not wrap after 71 minutes like us_ticker_read().
 
 */
 uint64_t clock_ms() {
-  return us_ticker_read() / 1000;
+  return ticker_read_us(get_us_ticker_data()) / 1000;
 }
@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+"""
+Program Name: arbitration_bench.py
+Purpose : Message cost of the broadcast and token passing arbitration modes.
+Description : N forklifts drop below nominal_soc at once and share one charger. The run counts, per
+                completed charge, broker deliveries (publishes fanned out to subscribed bridges,
+                acks included) and frames written to node UARTs, for:
+                  legacy     every broadcast reaches every node, every lower SOC node objects
+                  broadcast  arbitration_token 0: band topics, objections answered by the bridges
+                             with lowest SOC first and suppression of the later ones
+                  token_bc   token ring with joins/leaves on the shared ring topic (before the fix)
+                  token      arbitration_token 1: joins/leaves unicast to the holder, only the
+                             holder refresh goes to every member
+                Timers follow Argon_NodeX/main.cpp (objection window, round_gap, member_refresh,
+                token_hb, token_retry, token_timeout). Network delay is not modelled, only counts.
+Usage : python3 tools/arbitration_bench.py [--nodes 4,8,12,16] [--charge-s 120]
+Author: Kankan Sarkar
+Modifications : 19/10/2026-- V1.0-- Initial Creation
+"""
+import argparse
+import random
+
+band_width = 10
+objection_slot = 0.030
+objection_jitter = 0.200
+window_max = 5.0
+round_gap = 2.0
+legacy_window = 5.0
+member_refresh = 20.0
+token_hb = 4.0
+token_retry = 3.0
+token_timeout = 10.0
+max_Members = 16
+
+
+class Bench:
+    def __init__(self, mode, n, charge_s, seed):
+        rng = random.Random(seed)
+        self.mode = mode
+        self.charge_s = charge_s
+        self.soc = {i: rng.randint(5, 30) for i in range(1, n + 1)}
+        self.needy = set(self.soc)
+        self.deliveries = 0
+        self.uart = {i: 0 for i in self.soc}
+        self.charges = 0
+        self.charging = 0  # node on the charger
+        self.done_at = 0.0
+        self.queue = []  # waitlist of the coordinator
+        self.next = {i: rng.uniform(0, 1) for i in self.soc}  # next broadcast round / join refresh
+        self.holder = 0
+        self.known = {}  # holder's ring table: member -> soc
+        self.joined_to = {}  # holder each member last joined
+        self.request_t = 0.0
+        self.token_seen = 0.0
+
+    def deliver(self, targets, uart=True):
+        for i in targets:
+            self.deliveries += 1
+            if uart:
+                self.uart[i] += 1
+
+    def unicast(self, dest, uart=True):  # control frame plus its ack
+        self.deliveries += 2
+        if uart and dest in self.uart:
+            self.uart[dest] += 1
+
+    def to_coordinator(self, node, t):
+        self.deliveries += 1
+        if self.charging == 0:
+            self.grant(node, t)
+        elif node != self.charging and node not in self.queue:
+            self.queue.append(node)
+
+    def grant(self, node, t):
+        self.charging = node
+        self.done_at = t + self.charge_s
+        self.unicast(node)
+        self.needy.discard(node)
+        self.on_grant(node, t)
+
+    def on_grant(self, node, t):
+        if self.mode.startswith('token'):
+            others = [i for i in self.soc if i != node]
+            if node == self.holder:
+                self.known.pop(node, None)
+                nxt = min(self.known, key=lambda i: (self.known[i], i)) if self.known else 0
+                self.holder = 0
+                if nxt:
+                    self.unicast(nxt)
+                    self.take_token(nxt, t)
+            elif self.mode == 'token_bc':
+                self.deliver(others)
+            elif self.holder:
+                self.unicast(self.holder)
+                self.known.pop(node, None)
+
+    def take_token(self, node, t):
+        self.holder = node
+        self.token_seen = t
+        self.request_t = 0.0
+        self.known = {i: s for i, s in self.known.items() if i in self.needy and i != node}
+        self.beacon(node)
+        self.next[node] = t + token_hb
+
+    def beacon(self, node):
+        self.deliver([i for i in self.soc if i != node])
+        for i in self.needy:
+            if i != node and self.mode == 'token' and self.joined_to.get(i) != node:
+                self.join(i)  # new holder heard, join it
+
+    def join(self, i):
+        if self.mode == 'token_bc' or not self.holder:
+            self.deliver([j for j in self.soc if j != i])
+            heard = True
+        else:
+            self.unicast(self.holder)
+            heard = True
+        if heard and (self.holder or self.mode == 'token_bc') and len(self.known) < max_Members:
+            self.known[i] = self.soc[i]
+        self.joined_to[i] = self.holder
+
+    def step(self, t):
+        if self.charging and t >= self.done_at:
+            self.unicast(self.charging)  # release
+            self.charges += 1
+            self.soc[self.charging] = 100
+            self.charging = 0
+            if self.queue:
+                self.grant(self.queue.pop(0), t)
+        if self.mode in ('legacy', 'broadcast'):
+            self.step_broadcast(t)
+        else:
+            self.step_token(t)
+
+    def step_broadcast(self, t):
+        for i in sorted(self.needy):
+            if i in self.queue or t < self.next[i]:
+                continue
+            s = self.soc[i]
+            if self.mode == 'legacy':
+                heard = [j for j in self.soc if j != i]
+                self.deliver(heard)
+                objectors = [j for j in heard if self.soc[j] < s and j != self.charging]
+                for j in objectors:
+                    self.unicast(i)
+                self.next[i] = t + legacy_window + round_gap
+            else:
+                band = s // band_width
+                heard = [j for j in self.soc if j != i and self.soc[j] // band_width <= band]
+                self.deliver(heard, uart=False)  # bridges answer objections from the cached SOC
+                objectors = [j for j in heard if self.soc[j] < s and j != self.charging]
+                if objectors:
+                    self.deliver([j for j in heard], uart=False)  # first objection on the band topic, later ones suppressed
+                    self.uart[i] += 1
+                window = min(window_max, s * objection_slot + objection_jitter + 0.1)
+                self.next[i] = t + window + round_gap
+            if not objectors:
+                self.to_coordinator(i, t)
+
+    def step_token(self, t):
+        for i in sorted(self.needy):
+            if i not in self.joined_to or t >= self.next[i]:
+                self.join(i) if i != self.holder else self.beacon(i)
+                self.next[i] = t + (token_hb if i == self.holder else member_refresh)
+        if not self.holder and self.needy:
+            low = min(self.needy, key=lambda i: (self.soc[i], i))
+            if t - self.token_seen >= token_timeout * (self.soc[low] // band_width + 1):
+                self.take_token(low, t)  # regenerated by the lowest SOC band
+        if self.holder and t >= self.request_t:
+            neediest = min([self.holder] + list(self.known), key=lambda i: (self.soc.get(i, 255), i))
+            if neediest != self.holder:
+                self.unicast(neediest)
+                self.take_token(neediest, t)
+            else:
+                self.request_t = t + token_retry
+                self.to_coordinator(self.holder, t)
+
+    def run(self, limit=36000.0):
+        t = 0.0
+        n = len(self.soc)
+        while self.charges < n and t < limit:
+            self.step(t)
+            t += 0.1
+        return t
+
+
+def main():
+    ap = argparse.ArgumentParser(description='broadcast vs token arbitration message cost')
+    ap.add_argument('--nodes', default='4,8,12,16', help='fleet sizes, all nodes low at once')
+    ap.add_argument('--charge-s', type=float, default=120.0, help='charge duration per node')
+    ap.add_argument('--seed', type=int, default=1)
+    args = ap.parse_args()
+    print('nodes mode       deliveries/charge uart/charge  uart/node/min')
+    for n in [int(x) for x in args.nodes.split(',')]:
+        for mode in ('legacy', 'broadcast', 'token_bc', 'token'):
+            b = Bench(mode, n, args.charge_s, args.seed)
+            t = b.run()
+            uart = sum(b.uart.values())
+            print('%5d %-10s %17.1f %11.1f %14.2f' % (n, mode, b.deliveries / max(1, b.charges), uart / max(1, b.charges), uart / n / (t / 60.0)))
+
+
+if __name__ == '__main__':
+    main()
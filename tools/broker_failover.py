@@ -0,0 +1,244 @@
+#!/usr/bin/env python3
+"""
+Program Name: broker_failover.py
+Purpose : Exercises the broker failover of the ESP bridges on one Linux host.
+Description : Starts two broker processes (mosquitto if it is installed, else tools/mqtt_lite.py) and
+                two bridges running the failover logic of the bridge sketches: ordered broker list,
+                health echo every health_freq with failover after health_timeout, bounded connect
+                attempts, backoff with jitter once the whole list failed, resubscription on connect
+                and store and forward of frames while no broker is reachable.
+                The publisher bridge forwards a numbered charge request every 100 ms to the
+                coordinator topic, the subscriber bridge (coordinator side) counts what arrives.
+                The preferred broker is then killed (or frozen with SIGSTOP, which only the health
+                echo can detect), restarted, and the second broker is failed the same way.
+                Reported per phase: time each bridge needed to reach the other broker, longest gap
+                in the frames at the subscriber, frames lost and frames delivered from the
+                store and forward queue.
+Usage : python3 tools/broker_failover.py [--mode kill|freeze] [--ports 18831,18832]
+Author: Kankan Sarkar
+Modifications : 19/10/2026-- V1.0-- Initial Creation
+"""
+import argparse
+import os
+import random
+import shutil
+import signal
+import subprocess
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mqtt_lite  # noqa: E402
+
+health_id = 17
+health_freq = 2.0
+health_timeout = 3.0
+connect_timeout = 1.0
+backoff_min = 0.5
+backoff_max = 30.0
+sf_depth = 8
+sf_ttl = 10.0
+keepalive = 5
+
+
+def now():
+    return time.monotonic()
+
+
+class BrokerProcess:
+    def __init__(self, port):
+        self.port = port
+        self.proc = None
+
+    def start(self):
+        if shutil.which('mosquitto'):
+            cmd = ['mosquitto', '-p', str(self.port)]
+        else:
+            cmd = [sys.executable, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'mqtt_lite.py'), '--port', str(self.port)]
+        self.proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        deadline = now() + 5
+        while now() < deadline:  # wait for the listener
+            probe = mqtt_lite.Client('probe%d' % self.port)
+            if probe.connect('127.0.0.1', self.port, timeout=0.2):
+                probe.disconnect()
+                return
+            time.sleep(0.05)
+        raise RuntimeError('broker on port %d did not start' % self.port)
+
+    def kill(self):
+        self.proc.kill()
+        self.proc.wait()
+
+    def freeze(self):
+        self.proc.send_signal(signal.SIGSTOP)
+
+    def thaw_and_stop(self):
+        self.proc.send_signal(signal.SIGCONT)
+        self.kill()
+
+
+class Bridge:
+    def __init__(self, name, ports, topics, on_frame=None):
+        self.name = name
+        self.ports = ports
+        self.topics = topics
+        self.on_frame = on_frame
+        self.broker = 0
+        self.client = None
+        self.retry_time = 0.0
+        self.backoff = backoff_min
+        self.health_time = 0.0
+        self.ping_sent = 0.0
+        self.held = []  # (topic, payload, expiry)
+        self.replayed = 0
+        self.outage_start = None
+        self.outages = []  # (lost at, reconnected at, broker index)
+        self.rng = random.Random(name)
+        self.lock = threading.Lock()
+        self.running = True
+        threading.Thread(target=self.run, daemon=True).start()
+
+    def connected(self):
+        return self.client is not None and self.client.connected
+
+    def on_message(self, topic, payload):
+        if topic == '%d/%s' % (health_id, self.name):
+            self.ping_sent = 0.0
+        elif self.on_frame:
+            self.on_frame(topic, payload)
+
+    def reconnect(self):
+        if self.outage_start is None:
+            self.outage_start = now()
+        if now() < self.retry_time:
+            return
+        client = mqtt_lite.Client(self.name, self.on_message)
+        if client.connect('127.0.0.1', self.ports[self.broker], keepalive, timeout=connect_timeout):
+            self.client = client
+            self.outages.append((self.outage_start, now(), self.broker))
+            self.outage_start = None
+            self.backoff = backoff_min
+            self.ping_sent = 0.0
+            client.subscribe('%d/%s' % (health_id, self.name))
+            for t in self.topics:
+                client.subscribe(t)
+        else:
+            self.broker = (self.broker + 1) % len(self.ports)  # next broker right away
+            if self.broker == 0:  # whole list failed, back off
+                self.retry_time = now() + self.backoff + self.rng.uniform(0, self.backoff / 2)
+                self.backoff = min(self.backoff * 2, backoff_max)
+
+    def send(self, topic, payload):
+        with self.lock:
+            if self.connected() and self.client.publish(topic, payload):
+                return
+            if len(self.held) == sf_depth:
+                self.held.pop(0)
+            self.held.append((topic, payload, now() + sf_ttl))
+
+    def run(self):
+        while self.running:
+            if not self.connected():
+                if self.client is not None:
+                    self.client.kill()
+                    self.client = None
+                self.reconnect()
+            else:
+                with self.lock:
+                    while self.held:
+                        topic, payload, expiry = self.held.pop(0)
+                        if now() <= expiry:
+                            self.client.publish(topic, payload)
+                            self.replayed += 1
+                if self.ping_sent and now() - self.ping_sent > health_timeout:  # broker stopped answering
+                    self.client.kill()
+                    self.client = None
+                    self.broker = (self.broker + 1) % len(self.ports)
+                    self.retry_time = now()
+                    self.ping_sent = 0.0
+                elif not self.ping_sent and now() >= self.health_time:
+                    self.health_time = now() + health_freq
+                    self.ping_sent = now()
+                    self.client.publish('%d/%s' % (health_id, self.name), '1')
+            time.sleep(0.01)
+
+    def stop(self):
+        self.running = False
+        if self.client:
+            self.client.disconnect()
+
+
+def phase(label, brokers, victim, mode, pub, sub, received, seq):
+    time.sleep(3.0)  # steady state before the failure
+    with received['lock']:
+        before = len(received['seqs'])
+    replayed_before = pub.replayed
+    t_fail = now()
+    if mode == 'kill':
+        brokers[victim].kill()
+    else:
+        brokers[victim].freeze()
+    time.sleep(8.0)
+    with received['lock']:
+        seqs = list(received['seqs'])
+        times = list(received['times'])
+    sent = [s for s, t in seq['sent'] if t >= t_fail - 1.0]
+    got = set(seqs)
+    lost = [s for s in sent if s not in got and s < seq['n'] - 10]
+    after = [t for t in times if t >= t_fail]
+    gaps = [b - a for a, b in zip(times, times[1:]) if b >= t_fail]
+    print('%-22s pub->%d in %5.0f ms  sub->%d in %5.0f ms  max gap %5.0f ms  lost %2d  from store %2d' % (
+        label,
+        pub.outages[-1][2] if pub.outages else -1, (pub.outages[-1][1] - t_fail) * 1000 if pub.outages and pub.outages[-1][1] > t_fail else float('nan'),
+        sub.outages[-1][2] if sub.outages else -1, (sub.outages[-1][1] - t_fail) * 1000 if sub.outages and sub.outages[-1][1] > t_fail else float('nan'),
+        max(gaps) * 1000 if gaps else float('nan'), len(lost), pub.replayed - replayed_before))
+
+
+def main():
+    ap = argparse.ArgumentParser(description='bridge broker failover with two local brokers')
+    ap.add_argument('--mode', choices=('kill', 'freeze'), default='kill', help='how the active broker fails')
+    ap.add_argument('--ports', default='18831,18832')
+    args = ap.parse_args()
+    ports = [int(p) for p in args.ports.split(',')]
+    print('brokers: %s on ports %s, failure: %s' % ('mosquitto' if shutil.which('mosquitto') else 'mqtt_lite', ports, args.mode))
+    brokers = [BrokerProcess(p) for p in ports]
+    for b in brokers:
+        b.start()
+    received = {'seqs': [], 'times': [], 'lock': threading.Lock()}
+
+    def on_frame(topic, payload):
+        with received['lock']:
+            received['seqs'].append(int(payload.decode().rstrip('#').split(',')[2]))
+            received['times'].append(now())
+
+    sub = Bridge('coord5', ports, ['5'], on_frame)
+    pub = Bridge('node3', ports, ['3'])
+    seq = {'n': 0, 'sent': []}
+
+    def publisher():
+        while True:
+            seq['n'] += 1
+            seq['sent'].append((seq['n'], now()))
+            pub.send('5', '3,20,%d#' % seq['n'])
+            time.sleep(0.1)
+
+    threading.Thread(target=publisher, daemon=True).start()
+    try:
+        phase('broker 0 fails', brokers, 0, args.mode, pub, sub, received, seq)
+        if args.mode == 'freeze':
+            brokers[0].thaw_and_stop()
+        brokers[0].start()  # back for the next phase
+        phase('broker 1 fails', brokers, 1, args.mode, pub, sub, received, seq)
+    finally:
+        pub.stop()
+        sub.stop()
+        for b in brokers:
+            try:
+                b.thaw_and_stop() if args.mode == 'freeze' else b.kill()
+            except Exception:
+                pass
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+"""
+Program Name: failover_bench.py
+Purpose : Measures hot standby coordinator failover on the host.
+Description : Two coordinator boards sharing one ID run the replication logic of
+                Argon_Coordinator/main.cpp (hot_standby 1): the active board heartbeats on
+                repl_id/ID every repl_hb, replicates queue/grant/release/dequeue events, and the
+                standby takes the ID over after failover_ms of heartbeat silence. Each board is an
+                MQTT client of the mqtt_lite broker stand-in, its bridge folded into it.
+                Per trial a node holds the charger, a second node waits in the queue and a probe
+                node sends a time request (op_time) every 50 ms. The active board is then killed
+                without a DISCONNECT at a random heartbeat phase and the run reports:
+                  detect_ms  kill -> standby active
+                  gap_ms     kill -> first probe answered by the new active board
+                  held       the charging node is confirmed again by the new board
+                  queued     the waiting node is still queued on the new board
+Usage : python3 tools/failover_bench.py [--trials 5] [--link-ms 0]
+Author: Kankan Sarkar
+Modifications : 19/10/2026-- V1.0-- Initial Creation
+"""
+import argparse
+import os
+import random
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mqtt_lite  # noqa: E402
+
+ID = 5  # coordinator ID shared by both boards
+repl_id = 14
+op_heartbeat, op_repl_queue, op_repl_grant, op_repl_release, op_repl_dequeue = 10, 11, 12, 13, 14
+op_time = 20
+repl_hb = 0.5  # s between heartbeats
+failover_ms = 2.0  # s of heartbeat silence before the standby takes over
+lease_s = 30.0
+
+
+def now():
+    return time.monotonic()
+
+
+class Board:
+    def __init__(self, port, board):
+        self.board = board
+        self.active = False
+        self.hb_seen = now() + board * failover_ms  # the standby gives the primary a head start
+        self.charging = 0
+        self.lease = 0.0
+        self.queue = {}
+        self.took_over = None
+        self.lock = threading.Lock()
+        self.client = mqtt_lite.Client('coord%d_%d' % (ID, board), self.on_message)
+        self.client.connect('127.0.0.1', port)
+        self.client.subscribe(str(ID))
+        self.client.subscribe('%d/%d' % (repl_id, ID))
+        self.running = True
+        self.thread = threading.Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    def send(self, topic, fields):
+        self.client.publish(str(topic), ','.join(str(f) for f in fields) + '#')
+
+    def repl(self, op, node, *args):
+        self.send('%d/%d' % (repl_id, ID), (ID, node, op, self.board) + args)
+
+    def on_message(self, topic, payload):
+        f = [int(x) for x in payload.decode().rstrip('#').split(',')]
+        f += [0] * (5 - len(f))
+        ident, stat, op, arg1, arg2 = f[:5]
+        with self.lock:
+            if topic.startswith('%d/' % repl_id):
+                if arg1 == self.board:
+                    return  # own frame echoed by the broker
+                if op == op_heartbeat:
+                    self.hb_seen = now()
+                    if self.active and arg1 < self.board:
+                        self.active = False
+                    if not self.active:
+                        self.charging = stat
+                        self.lease = now() + arg2 / 1000.0
+                elif self.active:
+                    return
+                elif op == op_repl_queue:
+                    self.queue[stat] = arg2
+                elif op == op_repl_grant:
+                    self.queue.pop(stat, None)
+                    self.charging = stat
+                    self.lease = now() + lease_s
+                elif op == op_repl_release:
+                    self.charging = 0
+                elif op == op_repl_dequeue:
+                    self.queue.pop(stat, None)
+                return
+            if not self.active:
+                return  # standby only follows the replication stream
+            if op == op_time:
+                t = int(now() * 1000) & 0xFFFFFFFF
+                self.send(ident, (ID, 0, op_time, arg1, t, t))
+            elif op == 0 and ident != self.charging:
+                self.queue[ident] = stat
+                self.repl(op_repl_queue, ident, stat)
+
+    def run(self):
+        next_hb = 0.0
+        while self.running:
+            with self.lock:
+                if not self.active and now() > self.hb_seen + failover_ms:
+                    self.active = True
+                    self.took_over = now()
+                    self.lease = now() + lease_s
+                    if self.charging:
+                        self.send(self.charging, (ID, 1))  # confirm the replicated grant
+                if self.active and now() > next_hb:
+                    next_hb = now() + repl_hb
+                    left = int(max(0.0, self.lease - now()) * 1000) if self.charging else 0
+                    self.repl(op_heartbeat, self.charging, left)
+                if self.active and not self.charging and self.queue:
+                    node = min(self.queue, key=lambda n: (self.queue[n], n))
+                    del self.queue[node]
+                    self.charging = node
+                    self.lease = now() + lease_s
+                    self.send(node, (ID, 1))
+                    self.repl(op_repl_grant, node)
+            time.sleep(0.005)
+
+    def kill(self):
+        self.running = False
+        self.client.kill()
+
+
+class Node:
+    def __init__(self, port, ident):
+        self.id = ident
+        self.grants = []
+        self.replies = []
+        self.client = mqtt_lite.Client('node%d' % ident, self.on_message)
+        self.client.connect('127.0.0.1', port)
+        self.client.subscribe(str(ident))
+
+    def on_message(self, topic, payload):
+        f = payload.decode().rstrip('#').split(',')
+        if len(f) >= 3 and int(f[2]) == op_time:
+            self.replies.append(now())
+        elif len(f) >= 2 and int(f[1]) == 1:
+            self.grants.append(now())
+
+    def request(self, soc):
+        self.client.publish(str(ID), '%d,%d#' % (self.id, soc))
+
+    def probe(self):
+        self.client.publish(str(ID), '%d,0,%d,%d#' % (self.id, op_time, int(now() * 1000) & 0xFFFFFFFF))
+
+
+def trial(link_ms, rng):
+    broker = mqtt_lite.Broker(0, link_ms).start()
+    primary = Board(broker.port, 0)
+    standby = Board(broker.port, 1)
+    holder, waiter, probe = Node(broker.port, 1001), Node(broker.port, 1002), Node(broker.port, 1003)
+    while not primary.active:  # the primary also waits failover_ms at boot for a running board
+        time.sleep(0.01)
+    holder.request(12)
+    time.sleep(0.2)
+    waiter.request(25)
+    time.sleep(1.0 + rng.uniform(0, repl_hb))  # random heartbeat phase at the kill
+    holder.grants = []
+    t_kill = now()
+    primary.kill()
+    gap = None
+    while now() - t_kill < failover_ms * 3:
+        probe.probe()
+        time.sleep(0.05)
+        answered = [t for t in probe.replies if t > t_kill]
+        if answered:
+            gap = answered[0] - t_kill
+            break
+    time.sleep(0.1)
+    detect = standby.took_over - t_kill if standby.took_over else None
+    held = standby.charging == 1001 and bool(holder.grants)
+    queued = 1002 in standby.queue
+    standby.kill()
+    broker.stop()
+    return detect, gap, held, queued
+
+
+def main():
+    ap = argparse.ArgumentParser(description='hot standby coordinator failover time')
+    ap.add_argument('--trials', type=int, default=5)
+    ap.add_argument('--link-ms', type=float, default=0.0, help='broker delivery delay')
+    ap.add_argument('--seed', type=int, default=1)
+    args = ap.parse_args()
+    rng = random.Random(args.seed)
+    print('trial detect_ms gap_ms held queued')
+    detects, gaps = [], []
+    for i in range(args.trials):
+        detect, gap, held, queued = trial(args.link_ms, rng)
+        print('%5d %9s %6s %4s %6s' % (i + 1, '%.0f' % (detect * 1000) if detect else '-', '%.0f' % (gap * 1000) if gap else '-', 'yes' if held else 'no', 'yes' if queued else 'no'))
+        if detect:
+            detects.append(detect * 1000)
+        if gap:
+            gaps.append(gap * 1000)
+    if gaps:
+        print('detect min/mean/max %.0f/%.0f/%.0f ms, service gap min/mean/max %.0f/%.0f/%.0f ms (expected %.0f..%.0f ms after the kill plus one probe period)' % (min(detects), sum(detects) / len(detects), max(detects), min(gaps), sum(gaps) / len(gaps), max(gaps), (failover_ms - repl_hb) * 1000, failover_ms * 1000))
+
+
+if __name__ == '__main__':
+    main()
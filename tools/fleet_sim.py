@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""
+Program Name: fleet_sim.py
+Purpose : Host side fleet simulator for the zone coordinators.
+Description : Runs the charge acquisition path of the firmware against a simulated fleet and reports
+                how long a node waits for a charger as coordinators (zones) are added.
+                Modelled after Argon_NodeX/main.cpp and Argon_Coordinator/main.cpp:
+                - a node at or below nominal_soc asks a coordinator every second (critical loop),
+                  Zones::pick() chooses it: home zone first, two random adverts once the home
+                  queue reaches zone_saturation;
+                - the coordinator admission stage coalesces, sheds above admit_depth, drops
+                  requests after admit_ttl and grants the lowest SOC when the charger is free;
+                - a grant from a second zone while the node charges elsewhere is declined
+                  (op_decline), --no-decline shows the charger idling until lease_ms instead;
+                - adverts and frames cross the broker with a fixed one way latency.
+                The peer/broadcast negotiation between nodes is not modelled, every node talks to
+                the coordinators directly.
+Usage : python3 tools/fleet_sim.py [--per-zone 6 | --nodes N] [--coords 1,2,4,8,16] [--hours 8]
+Author: Kankan Sarkar
+Modifications : 19/10/2026-- V1.0-- Initial Creation
+"""
+import argparse
+import heapq
+import random
+
+nominal_soc = 30  # SOC at or below which a node asks for the charger
+full_soc = 95  # SOC at which the operator ends the charge (charging_Done)
+zone_saturation = 2  # home queue length at which other zones are considered
+admit_depth = 8  # pending requests per coordinator
+admit_ttl = 15.0  # s a pending request waits before it is dropped
+admit_retry = 5.0  # s a shed node backs off
+lease_s = 30.0  # s a grant lives without renewal from the charging node
+charge_rate = 5.0 / 60  # SOC points per s on the charger
+tick = 1.0  # s, node loop period
+
+
+class Coordinator:
+    def __init__(self, cid):
+        self.id = cid
+        self.node = 0  # charging node, 0 -> free
+        self.lease = 0.0
+        self.queue = {}  # node -> (soc, admitted at)
+        self.advert = None
+        self.stray = 0.0  # charger seconds held by a node charging elsewhere
+        self.stray_since = None
+
+
+class Sim:
+    def __init__(self, nodes, coords, hours, latency, decline, seed):
+        self.rng = random.Random(seed)
+        self.latency = latency
+        self.decline = decline
+        self.end = hours * 3600.0
+        self.events = []
+        self.seq = 0
+        self.coords = [Coordinator(100 + c) for c in range(coords)]
+        self.by_id = {c.id: c for c in self.coords}
+        self.adverts = {}  # coordinator -> (busy, queue length, lowest SOC) as seen by the nodes
+        self.nodes = []
+        for n in range(nodes):
+            self.nodes.append({
+                'id': 1000 + n,
+                'home': self.coords[n % coords].id,
+                'soc': self.rng.uniform(nominal_soc + 5, 100),
+                'drain': self.rng.uniform(0.3, 0.7) / 60,  # SOC points per s while working
+                'at': 0,  # coordinator charging this node, 0 -> none
+                'need': None,  # time the node crossed nominal_soc
+                'hold_off': 0.0,
+            })
+        self.waits = []
+        self.frames = 0
+        self.declines = 0
+        for c in self.coords:
+            self.publish(c, 0.0)
+        self.push(0.0, 'tick', None)
+
+    def push(self, t, kind, arg):
+        self.seq += 1
+        heapq.heappush(self.events, (t, self.seq, kind, arg))
+
+    def send(self, t, kind, arg):  # one broker hop
+        self.frames += 1
+        self.push(t + self.latency, kind, arg)
+
+    def publish(self, c, t):
+        advert = (c.node != 0, len(c.queue), min([s for s, _ in c.queue.values()] or [255]))
+        if advert != c.advert:
+            c.advert = advert
+            self.send(t, 'advert', (c.id, advert))
+
+    def pick(self, node):
+        home = self.adverts.get(node['home'])
+        if home is None or home[1] < zone_saturation:
+            return node['home']
+        known = list(self.adverts)
+        a = self.rng.choice(known)
+        b = self.rng.choice(known)
+        load = lambda cid: self.adverts[cid][0] + self.adverts[cid][1]
+        return a if load(a) <= load(b) else b
+
+    def serve(self, c, t):
+        for nid in [n for n, (_, at) in c.queue.items() if t - at > admit_ttl]:
+            del c.queue[nid]
+        if c.node != 0 and t > c.lease:
+            self.free(c, t)  # lease ran out, the holder never renewed it here
+        if c.node == 0 and c.queue:
+            nid = min(c.queue, key=lambda n: (c.queue[n][0], n))
+            del c.queue[nid]
+            c.node = nid
+            c.lease = t + lease_s
+            self.send(t, 'grant', (c.id, nid))
+        self.publish(c, t)
+
+    def free(self, c, t):
+        if c.stray_since is not None:
+            c.stray += t - c.stray_since
+            c.stray_since = None
+        c.node = 0
+
+    def run(self):
+        while self.events:
+            t, _, kind, arg = heapq.heappop(self.events)
+            if t > self.end:
+                break
+            if kind == 'tick':
+                self.on_tick(t)
+                self.push(t + tick, 'tick', None)
+            elif kind == 'advert':
+                self.adverts[arg[0]] = arg[1]
+            elif kind == 'request':
+                cid, nid, soc = arg
+                c = self.by_id[cid]
+                if c.node == nid:
+                    c.lease = t + lease_s  # renewal with the telemetry
+                elif nid in c.queue or len(c.queue) < admit_depth:
+                    c.queue[nid] = (soc, t)
+                else:
+                    self.send(t, 'busy', nid)
+                self.serve(c, t)
+            elif kind == 'busy':
+                self.nodes[arg - 1000]['hold_off'] = t + admit_retry
+            elif kind == 'grant':
+                self.on_grant(t, *arg)
+            elif kind in ('release', 'decline'):
+                cid, nid = arg
+                c = self.by_id[cid]
+                if c.node == nid:
+                    self.free(c, t)
+                self.serve(c, t)
+
+    def on_grant(self, t, cid, nid):
+        node = self.nodes[nid - 1000]
+        if node['at'] == 0:
+            node['at'] = cid
+            if node['need'] is not None:
+                self.waits.append(t - node['need'])
+                node['need'] = None
+        elif node['at'] != cid:
+            c = self.by_id[cid]
+            c.stray_since = t
+            if self.decline:
+                self.declines += 1
+                self.send(t, 'decline', (cid, nid))
+
+    def on_tick(self, t):
+        for node in self.nodes:
+            if node['at'] != 0:
+                node['soc'] = min(100.0, node['soc'] + charge_rate * tick)
+                if node['soc'] >= full_soc:
+                    self.send(t, 'release', (node['at'], node['id']))
+                    node['at'] = 0
+                elif int(t) % 10 == 0:
+                    self.send(t, 'request', (node['at'], node['id'], int(node['soc'])))  # lease renewal
+                continue
+            node['soc'] = max(0.0, node['soc'] - node['drain'] * tick)
+            if node['soc'] <= nominal_soc:
+                if node['need'] is None:
+                    node['need'] = t
+                if t >= node['hold_off']:
+                    self.send(t, 'request', (self.pick(node), node['id'], int(node['soc'])))
+        for c in self.coords:
+            self.serve(c, t)
+
+    def report(self):
+        w = sorted(self.waits)
+        pct = lambda p: w[min(len(w) - 1, int(p * len(w)))] if w else float('nan')
+        starved = sum(1 for n in self.nodes if n['need'] is not None and self.end - n['need'] > 600)
+        stray = sum(c.stray for c in self.coords)
+        return len(w), (sum(w) / len(w) if w else float('nan')), pct(0.5), pct(0.95), (w[-1] if w else float('nan')), starved, self.declines, stray, self.frames
+
+
+def main():
+    ap = argparse.ArgumentParser(description='charge acquisition latency as coordinators are added')
+    ap.add_argument('--coords', default='1,2,4,8,16', help='coordinator counts to sweep')
+    ap.add_argument('--per-zone', type=int, default=6, help='nodes per coordinator (fleet grows with the zones)')
+    ap.add_argument('--nodes', type=int, default=0, help='fixed fleet size instead of --per-zone')
+    ap.add_argument('--hours', type=float, default=8.0, help='simulated time per run')
+    ap.add_argument('--latency-ms', type=float, default=30.0, help='one way broker hop')
+    ap.add_argument('--no-decline', action='store_true', help='ignore second zone grants (no op_decline)')
+    ap.add_argument('--seed', type=int, default=1)
+    args = ap.parse_args()
+    print('coords nodes grants  mean_s   p50_s   p95_s   max_s starved declines stray_charger_s frames')
+    for coords in [int(c) for c in args.coords.split(',')]:
+        nodes = args.nodes or args.per_zone * coords
+        sim = Sim(nodes, coords, args.hours, args.latency_ms / 1000.0, not args.no_decline, args.seed)
+        sim.run()
+        n, mean, p50, p95, mx, starved, declines, stray, frames = sim.report()
+        print('%6d %5d %6d %7.1f %7.1f %7.1f %7.1f %7d %8d %15.0f %6d' % (coords, nodes, n, mean, p50, p95, mx, starved, declines, stray, frames))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""
+Program Name: hop_latency.py
+Purpose : Measures the negotiation round trip with and without the central broker hop.
+Description : A node bridge sends numbered charge requests to its zone coordinator and waits for each
+                reply, the round trip the coordinator bridge reports as its max ack rtt counter.
+                central  : node bridge -> central broker -> coordinator bridge -> central broker ->
+                           node bridge, four WiFi/LAN hops through the PC running the broker.
+                embedded : the coordinator bridge is the broker of its zone (embedded_broker 1), the
+                           request is answered inside the broker process, two hops.
+                Every hop (uplink publish and broker delivery) is delayed by hop_ms, coord_ms stands
+                for the UART and coordinator turn around on the STM32 side. Reported per mode:
+                min, median, 95th percentile and max round trip in ms, and the saving of the
+                embedded broker.
+Usage : python3 tools/hop_latency.py [--hop-ms 4] [--coord-ms 15] [--requests 200]
+Author: Kankan Sarkar
+Modifications : 19/10/2026-- V1.0-- Initial Creation
+"""
+import argparse
+import os
+import queue
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mqtt_lite  # noqa: E402
+
+ID = 5  # zone coordinator
+node = 7  # requesting node
+op_request = 4
+
+
+class Uplink:
+    """Publishes of one bridge, each leaving after the hop delay and in order."""
+
+    def __init__(self, client, hop):
+        self.client = client
+        self.hop = hop
+        self.out = queue.Queue()
+        threading.Thread(target=self.writer, daemon=True).start()
+
+    def publish(self, topic, payload):
+        self.out.put((time.monotonic() + self.hop, topic, payload))
+
+    def writer(self):
+        while True:
+            due, topic, payload = self.out.get()
+            wait = due - time.monotonic()
+            if wait > 0:
+                time.sleep(wait)
+            self.client.publish(topic, payload)
+
+
+def reply(publish, payload, coord):
+    # request "node,ID,soc,op,seq#" -> reply "ID,node,seq#" on the node topic after the coordinator turn around
+    f = payload.decode().rstrip('#').split(',')
+    threading.Timer(coord, publish, args=(f[0], '%d,%s,%s#' % (ID, f[0], f[4]))).start()
+
+
+def run(mode, hop, coord, requests):
+    broker = mqtt_lite.Broker(link_ms=hop * 1000).start()
+    if mode == 'central':
+        bridge = mqtt_lite.Client('coord%d_0' % ID)
+        bridge.connect('127.0.0.1', broker.port)
+        up = Uplink(bridge, hop)
+        bridge.on_message = lambda t, p: reply(up.publish, p, coord)
+        bridge.subscribe(str(ID))
+    else:
+        def hook(topic, payload):
+            if topic == str(ID):
+                reply(lambda t, p: broker.publish(t, p.encode()), payload, coord)
+        broker.hook = hook
+    done = threading.Event()
+    got = {}
+
+    def on_message(topic, payload):
+        seq = int(payload.decode().rstrip('#').split(',')[2])
+        got[seq] = time.monotonic()
+        done.set()
+
+    nb = mqtt_lite.Client('node%d' % node, on_message)
+    nb.connect('127.0.0.1', broker.port)
+    nb.subscribe(str(node))
+    time.sleep(0.2)  # subscriptions in place
+    up = Uplink(nb, hop)
+    rtt = []
+    for seq in range(requests):
+        done.clear()
+        sent = time.monotonic()
+        up.publish(str(ID), '%d,%d,40,%d,%d#' % (node, ID, op_request, seq))
+        if done.wait(2.0) and seq in got:
+            rtt.append((got[seq] - sent) * 1000)
+    nb.disconnect()
+    broker.stop()
+    return rtt
+
+
+def summary(rtt):
+    s = sorted(rtt)
+    return s[0], s[len(s) // 2], s[int(len(s) * 0.95) - 1], s[-1]
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('--hop-ms', type=float, default=4.0)
+    ap.add_argument('--coord-ms', type=float, default=15.0)
+    ap.add_argument('--requests', type=int, default=200)
+    a = ap.parse_args()
+    print('hop %.1f ms, coordinator turn around %.1f ms, %d requests' % (a.hop_ms, a.coord_ms, a.requests))
+    print('%-9s %6s %8s %8s %8s %8s' % ('mode', 'replies', 'min', 'median', 'p95', 'max'))
+    med = {}
+    for mode in ('central', 'embedded'):
+        rtt = run(mode, a.hop_ms / 1000, a.coord_ms / 1000, a.requests)
+        if not rtt:
+            print('%-9s %6d' % (mode, 0))
+            continue
+        lo, md, p95, hi = summary(rtt)
+        med[mode] = md
+        print('%-9s %6d %8.1f %8.1f %8.1f %8.1f' % (mode, len(rtt), lo, md, p95, hi))
+    if len(med) == 2:
+        print('embedded broker saves %.1f ms median per negotiation round trip' % (med['central'] - med['embedded']))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,361 @@
+#!/usr/bin/env python3
+"""
+Program Name: mqtt_lite.py
+Purpose : Minimal MQTT 3.1.1 broker and client for host side measurements.
+Description : Broker stand-in for the HiveMQ/mosquitto instance the bridges talk to, so failover and
+                latency can be measured on one Linux host without installing a broker. It covers
+                what PubSubClient and the dashboard use: CONNECT with last will and keepalive,
+                SUBSCRIBE/UNSUBSCRIBE with + and # filters, QoS 0 delivery (QoS 1 publishes are
+                acknowledged and delivered at QoS 0), retained messages and PINGREQ. Sessions are
+                always clean.
+                Each delivery can be delayed by link_ms to stand for a broker on the far side of a
+                network hop, and a publish hook lets a test run a client inside the broker process.
+Usage : python3 tools/mqtt_lite.py [--port 1883] [--link-ms 0]
+Author: Kankan Sarkar
+Modifications : 19/10/2026-- V1.0-- Initial Creation
+"""
+import argparse
+import queue
+import socket
+import struct
+import threading
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK = 1, 2, 3, 4
+SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK = 8, 9, 10, 11
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+
+
+def encode_len(n):
+    out = bytearray()
+    while True:
+        b = n % 128
+        n //= 128
+        out.append(b | (0x80 if n else 0))
+        if not n:
+            return bytes(out)
+
+
+def packet(kind, flags, body):
+    return bytes([kind << 4 | flags]) + encode_len(len(body)) + body
+
+
+def string(s):
+    if isinstance(s, str):
+        s = s.encode()
+    return struct.pack('!H', len(s)) + s
+
+
+def read_exact(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError('closed')
+        data += chunk
+    return data
+
+
+def read_packet(sock):
+    head = read_exact(sock, 1)[0]
+    n, mult = 0, 1
+    while True:
+        b = read_exact(sock, 1)[0]
+        n += (b & 0x7F) * mult
+        mult *= 128
+        if not b & 0x80:
+            break
+    return head >> 4, head & 0x0F, read_exact(sock, n) if n else b''
+
+
+def take_string(body, pos):
+    n = struct.unpack_from('!H', body, pos)[0]
+    return body[pos + 2:pos + 2 + n], pos + 2 + n
+
+
+def matches(filt, topic):
+    f, t = filt.split('/'), topic.split('/')
+    for i, part in enumerate(f):
+        if part == '#':
+            return True
+        if i >= len(t) or (part != '+' and part != t[i]):
+            return False
+    return len(f) == len(t)
+
+
+class Session:
+    def __init__(self, broker, sock):
+        self.broker = broker
+        self.sock = sock
+        self.client_id = None
+        self.subs = set()
+        self.will = None
+        self.keepalive = 0
+        self.alive = True
+        self.out = queue.Queue()
+        threading.Thread(target=self.writer, daemon=True).start()
+
+    def send(self, data, delay=0.0):
+        self.out.put((time.monotonic() + delay, data))
+
+    def writer(self):  # deliveries leave in order, each after its link delay
+        while self.alive:
+            due, data = self.out.get()
+            if data is None:
+                break
+            wait = due - time.monotonic()
+            if wait > 0:
+                time.sleep(wait)
+            try:
+                self.sock.sendall(data)
+            except OSError:
+                break
+
+    def run(self):
+        graceful = False
+        try:
+            while True:
+                kind, flags, body = read_packet(self.sock)
+                if kind == CONNECT:
+                    self.on_connect(body)
+                elif kind == PUBLISH:
+                    qos = (flags >> 1) & 3
+                    topic, pos = take_string(body, 0)
+                    if qos:
+                        self.send(packet(PUBACK, 0, body[pos:pos + 2]))
+                        pos += 2
+                    self.broker.publish(topic.decode(), body[pos:], bool(flags & 1))
+                elif kind == SUBSCRIBE:
+                    pid, pos, granted, new = body[:2], 2, bytearray(), []
+                    while pos < len(body):
+                        filt, pos = take_string(body, pos)
+                        pos += 1
+                        self.subs.add(filt.decode())
+                        new.append(filt.decode())
+                        granted.append(0)
+                    self.send(packet(SUBACK, 0, pid + bytes(granted)))
+                    self.broker.send_retained(self, new)
+                elif kind == UNSUBSCRIBE:
+                    pid, pos = body[:2], 2
+                    while pos < len(body):
+                        filt, pos = take_string(body, pos)
+                        self.subs.discard(filt.decode())
+                    self.send(packet(UNSUBACK, 0, pid))
+                elif kind == PINGREQ:
+                    self.send(packet(PINGRESP, 0, b''))
+                elif kind == DISCONNECT:
+                    graceful = True
+                    break
+        except (ConnectionError, OSError, struct.error):
+            pass
+        self.close(not graceful)
+
+    def on_connect(self, body):
+        _, pos = take_string(body, 0)
+        flags = body[pos + 1]
+        self.keepalive = struct.unpack_from('!H', body, pos + 2)[0]
+        pos += 4
+        cid, pos = take_string(body, pos)
+        self.client_id = cid.decode()
+        if flags & 0x04:
+            wt, pos = take_string(body, pos)
+            wm, pos = take_string(body, pos)
+            self.will = (wt.decode(), wm, bool(flags & 0x20))
+        if self.keepalive:
+            self.sock.settimeout(self.keepalive * 1.5)  # missed keepalive fires the last will
+        self.broker.attach(self)
+        self.send(packet(CONNACK, 0, b'\x00\x00'))
+
+    def close(self, fire_will):
+        if not self.alive:
+            return
+        self.alive = False
+        self.out.put((0, None))
+        try:
+            self.sock.close()
+        except OSError:
+            pass
+        self.broker.detach(self)
+        if fire_will and self.will:
+            self.broker.publish(*self.will)
+
+
+class Broker:
+    def __init__(self, port=0, link_ms=0.0, host='127.0.0.1'):
+        self.link = link_ms / 1000.0
+        self.sessions = []
+        self.retained = {}
+        self.hook = None  # hook(topic, payload) runs for every publish, in the broker process
+        self.lock = threading.Lock()
+        self.server = socket.socket()
+        self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.server.bind((host, port))
+        self.server.listen(64)
+        self.port = self.server.getsockname()[1]
+        self.running = True
+
+    def start(self):
+        threading.Thread(target=self.serve, daemon=True).start()
+        return self
+
+    def serve(self):
+        while self.running:
+            try:
+                sock, _ = self.server.accept()
+            except OSError:
+                break
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            threading.Thread(target=Session(self, sock).run, daemon=True).start()
+
+    def stop(self):  # abrupt, like a killed broker process
+        self.running = False
+        self.server.close()
+        with self.lock:
+            sessions = list(self.sessions)
+        for s in sessions:
+            s.will = None
+            s.close(False)
+
+    def attach(self, session):
+        with self.lock:
+            for old in [s for s in self.sessions if s.client_id == session.client_id]:
+                old.will = None
+                threading.Thread(target=old.close, args=(False,), daemon=True).start()
+            self.sessions.append(session)
+
+    def detach(self, session):
+        with self.lock:
+            if session in self.sessions:
+                self.sessions.remove(session)
+
+    def publish(self, topic, payload, retain=False):
+        if retain:
+            if payload:
+                self.retained[topic] = payload
+            else:
+                self.retained.pop(topic, None)
+        if self.hook:
+            self.hook(topic, payload)
+        data = packet(PUBLISH, 0, string(topic) + payload)
+        with self.lock:
+            targets = [s for s in self.sessions if any(matches(f, topic) for f in s.subs)]
+        for s in targets:
+            s.send(data, self.link)
+
+    def send_retained(self, session, filters):
+        for topic, payload in list(self.retained.items()):
+            if any(matches(f, topic) for f in filters):
+                session.send(packet(PUBLISH, 1, string(topic) + payload), self.link)
+
+
+class Client:
+    """Blocking MQTT client in the shape of PubSubClient: connect, subscribe, publish, on_message."""
+
+    def __init__(self, client_id, on_message=None):
+        self.client_id = client_id
+        self.on_message = on_message
+        self.sock = None
+        self.connected = False
+        self.pid = 0
+        self.lock = threading.Lock()
+        self.pong = threading.Event()
+
+    def connect(self, host, port, keepalive=5, will=None, timeout=1.0):
+        try:
+            sock = socket.create_connection((host, port), timeout=timeout)
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            flags = 0x02
+            payload = string(self.client_id)
+            if will:
+                flags |= 0x04
+                payload += string(will[0]) + string(will[1])
+            sock.sendall(packet(CONNECT, 0, string('MQTT') + bytes([4, flags]) + struct.pack('!H', keepalive) + payload))
+            kind, _, body = read_packet(sock)
+            if kind != CONNACK or body[1] != 0:
+                sock.close()
+                return False
+        except (OSError, ConnectionError):
+            return False
+        sock.settimeout(None)
+        self.sock = sock
+        self.connected = True
+        threading.Thread(target=self.reader, daemon=True).start()
+        return True
+
+    def reader(self):
+        sock = self.sock
+        try:
+            while True:
+                kind, flags, body = read_packet(sock)
+                if kind == PUBLISH:
+                    topic, pos = take_string(body, 0)
+                    if (flags >> 1) & 3:
+                        pos += 2
+                    if self.on_message:
+                        self.on_message(topic.decode(), body[pos:])
+                elif kind == PINGRESP:
+                    self.pong.set()
+        except (ConnectionError, OSError, struct.error):
+            pass
+        if sock is self.sock:
+            self.connected = False
+
+    def write(self, data):
+        try:
+            with self.lock:
+                self.sock.sendall(data)
+            return True
+        except (OSError, AttributeError):
+            self.connected = False
+            return False
+
+    def next_pid(self):
+        self.pid = self.pid % 65535 + 1
+        return struct.pack('!H', self.pid)
+
+    def subscribe(self, topic):
+        return self.write(packet(SUBSCRIBE, 2, self.next_pid() + string(topic) + b'\x00'))
+
+    def unsubscribe(self, topic):
+        return self.write(packet(UNSUBSCRIBE, 2, self.next_pid() + string(topic)))
+
+    def publish(self, topic, payload, retain=False):
+        if isinstance(payload, str):
+            payload = payload.encode()
+        return self.write(packet(PUBLISH, 1 if retain else 0, string(topic) + payload))
+
+    def ping(self):
+        self.pong.clear()
+        return self.write(packet(PINGREQ, 0, b''))
+
+    def disconnect(self):
+        self.write(packet(DISCONNECT, 0, b''))
+        self.kill()
+
+    def kill(self):  # drop the TCP link without DISCONNECT, the broker fires the last will
+        self.connected = False
+        if self.sock:
+            try:
+                self.sock.shutdown(socket.SHUT_RDWR)
+                self.sock.close()
+            except OSError:
+                pass
+
+
+def main():
+    ap = argparse.ArgumentParser(description='minimal MQTT 3.1.1 broker stand-in')
+    ap.add_argument('--port', type=int, default=1883)
+    ap.add_argument('--host', default='127.0.0.1')
+    ap.add_argument('--link-ms', type=float, default=0.0, help='delay added to every delivery')
+    args = ap.parse_args()
+    broker = Broker(args.port, args.link_ms, args.host).start()
+    print('mqtt_lite listening on %s:%d' % (args.host, broker.port), flush=True)
+    try:
+        while True:
+            time.sleep(3600)
+    except KeyboardInterrupt:
+        broker.stop()
+
+
+if __name__ == '__main__':
+    main()